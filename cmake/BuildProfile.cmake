@@ -0,0 +1,93 @@
+# SPDX-FileCopyrightText: 2015 - 2024 Rime community
+#
+# SPDX-License-Identifier: GPL-3.0-or-later
+
+# Release build profiles.
+#
+# size:  everything at -Oz, the smallest library.
+# speed: the libraries on the keystroke path at -O2/-O3, the rest at -Oz.
+#        The flags are per target and come after CMAKE_CXX_FLAGS, so they
+#        win over the global -Oz when compiling. Under LTO the optimization
+#        level of the link decides instead, which the -Oz link flags drop
+#        to 2; the speed profile links at --lto-O3, while code compiled at
+#        -Oz keeps its minsize attribute and stays small.
+#
+# Either profile can be combined with profile guided optimization:
+# TRIME_PGO=generate instruments the build, TRIME_PGO=use reads the merged
+# profile from TRIME_PGO_PROFILE. `python make.py pgo` trains one with the
+# keystroke replay benchmark.
+
+set(TRIME_BUILD_PROFILE
+    "size"
+    CACHE STRING "Release build profile: size or speed")
+set_property(CACHE TRIME_BUILD_PROFILE PROPERTY STRINGS size speed)
+
+set(TRIME_PGO
+    "off"
+    CACHE STRING "Profile guided optimization: off, generate or use")
+set_property(CACHE TRIME_PGO PROPERTY STRINGS off generate use)
+set(TRIME_PGO_DIR
+    "${CMAKE_BINARY_DIR}/pgo"
+    CACHE PATH "Where instrumented binaries write their .profraw files")
+set(TRIME_PGO_PROFILE
+    ""
+    CACHE FILEPATH "Merged .profdata used when TRIME_PGO is use")
+
+# tight loops: trie lookups and block decompression
+set(TRIME_HOT_TARGETS_O3 marisa snappy)
+# translators, the user dictionary and the snapshot path
+set(TRIME_HOT_TARGETS_O2 rime-static rime-octagram-objs leveldb rime_jni
+                         rime_replay)
+# where LTO happens
+set(TRIME_LINKED_TARGETS rime_jni rime_replay)
+
+if(NOT TRIME_BUILD_PROFILE MATCHES "^(size|speed)$")
+  message(FATAL_ERROR "Unknown TRIME_BUILD_PROFILE: ${TRIME_BUILD_PROFILE}")
+endif()
+
+# instrumentation has to reach every target, so it goes in before them
+if(TRIME_PGO STREQUAL "generate")
+  if(NOT CMAKE_CXX_COMPILER_ID MATCHES "Clang")
+    message(FATAL_ERROR "TRIME_PGO requires clang")
+  endif()
+  add_compile_options("-fprofile-generate=${TRIME_PGO_DIR}")
+  add_link_options("-fprofile-generate=${TRIME_PGO_DIR}")
+elseif(TRIME_PGO STREQUAL "use")
+  if(NOT CMAKE_CXX_COMPILER_ID MATCHES "Clang")
+    message(FATAL_ERROR "TRIME_PGO requires clang")
+  endif()
+  if(NOT EXISTS "${TRIME_PGO_PROFILE}")
+    message(FATAL_ERROR "TRIME_PGO_PROFILE not found: ${TRIME_PGO_PROFILE}")
+  endif()
+  # the profile may come from another ABI or an older tree, functions that
+  # no longer match are simply left unprofiled
+  add_compile_options(
+    "-fprofile-use=${TRIME_PGO_PROFILE}" "-Wno-profile-instr-unprofiled"
+    "-Wno-profile-instr-out-of-date" "-Wno-backend-plugin")
+  add_link_options("-fprofile-use=${TRIME_PGO_PROFILE}")
+elseif(NOT TRIME_PGO STREQUAL "off")
+  message(FATAL_ERROR "Unknown TRIME_PGO: ${TRIME_PGO}")
+endif()
+
+# Called once all targets exist.
+function(trime_apply_build_profile)
+  if(NOT CMAKE_BUILD_TYPE STREQUAL "Release" OR TRIME_BUILD_PROFILE STREQUAL
+                                                 "size")
+    return()
+  endif()
+  foreach(target ${TRIME_HOT_TARGETS_O3})
+    if(TARGET ${target})
+      target_compile_options(${target} PRIVATE -O3)
+    endif()
+  endforeach()
+  foreach(target ${TRIME_HOT_TARGETS_O2})
+    if(TARGET ${target})
+      target_compile_options(${target} PRIVATE -O2)
+    endif()
+  endforeach()
+  foreach(target ${TRIME_LINKED_TARGETS})
+    if(TARGET ${target})
+      target_link_options(${target} PRIVATE -Wl,--lto-O3)
+    endif()
+  endforeach()
+endfunction()
@@ -0,0 +1,127 @@
+/*
+ * SPDX-FileCopyrightText: 2015 - 2025 Rime community
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+#pragma once
+
+#include <cstddef>
+#include <cstring>
+#include <memory>
+#include <memory_resource>
+#include <optional>
+#include <string_view>
+
+//! Bump allocator for the temporaries of one snapshot (context, candidate
+//! list, jstring conversion). Everything is dropped at once when the next
+//! snapshot starts, and the buffer grows to fit the largest snapshot seen,
+//! so once warmed up a keystroke no longer touches the native heap. A
+//! buffer grown past kMaxRetained is freed when its scope ends.
+//!
+//! There is one arena per thread: a session's snapshots are built on the
+//! thread asking for them, which spares us any locking. The buffer is only
+//! allocated by the first Scope, other threads (a JString built anywhere)
+//! allocate from the default resource and cost nothing here.
+class SnapshotArena {
+ public:
+  //! Makes the calling thread's arena active until destroyed, releasing
+  //! whatever the previous snapshot allocated. Nested scopes share the
+  //! outermost snapshot.
+  class Scope {
+   public:
+    Scope() : arena_(instance()) {
+      if (arena_.depth_++ == 0)
+        arena_.reset();
+    }
+    ~Scope() {
+      if (--arena_.depth_ == 0)
+        arena_.trim();
+    }
+    Scope(const Scope&) = delete;
+    Scope& operator=(const Scope&) = delete;
+
+   private:
+    SnapshotArena& arena_;
+  };
+
+  //! The active arena of the calling thread, or the default resource when
+  //! called outside of a Scope.
+  static std::pmr::memory_resource* resource() {
+    SnapshotArena& arena = instance();
+    return arena.depth_ ? &*arena.pool_ : std::pmr::get_default_resource();
+  }
+
+  //! Copies `str` into the active arena, null-terminated. Only to be used
+  //! inside a Scope, the copy is not freed otherwise.
+  static std::string_view copy(std::string_view str) {
+    auto* data = static_cast<char*>(resource()->allocate(str.size() + 1, 1));
+    std::memcpy(data, str.data(), str.size());
+    data[str.size()] = '\0';
+    return {data, str.size()};
+  }
+
+ private:
+  //! Counts what the pool had to borrow beyond its own buffer.
+  class OverflowResource : public std::pmr::memory_resource {
+   public:
+    size_t borrowed = 0;
+
+   private:
+    void* do_allocate(size_t bytes, size_t alignment) override {
+      borrowed += bytes;
+      return std::pmr::new_delete_resource()->allocate(bytes, alignment);
+    }
+    void do_deallocate(void* p, size_t bytes, size_t alignment) override {
+      std::pmr::new_delete_resource()->deallocate(p, bytes, alignment);
+    }
+    bool do_is_equal(const memory_resource& other) const noexcept override {
+      return this == &other;
+    }
+  };
+
+  static constexpr size_t kInitialSize = 16 * 1024;
+  static constexpr size_t kMaxRetained = 256 * 1024;
+
+  static SnapshotArena& instance() {
+    thread_local SnapshotArena arena;
+    return arena;
+  }
+
+  void reset() {
+    if (!pool_) {
+      rebuild(kInitialSize);
+      return;
+    }
+    if (overflow_.borrowed == 0) {
+      pool_->release();
+      return;
+    }
+    // the last snapshot did not fit, make room for it next time
+    size_t size = size_ + overflow_.borrowed;
+    pool_.reset();
+    overflow_.borrowed = 0;
+    rebuild(size);
+  }
+
+  //! Frees a buffer that one unusual snapshot blew up, the next scope
+  //! starts over at kInitialSize.
+  void trim() {
+    if (size_ + overflow_.borrowed <= kMaxRetained)
+      return;
+    pool_.reset();
+    buffer_.reset();
+    size_ = 0;
+    overflow_.borrowed = 0;
+  }
+
+  void rebuild(size_t size) {
+    size_ = size;
+    buffer_ = std::make_unique<std::byte[]>(size);
+    pool_.emplace(buffer_.get(), size, &overflow_);
+  }
+
+  int depth_ = 0;
+  size_t size_ = 0;
+  std::unique_ptr<std::byte[]> buffer_;
+  OverflowResource overflow_;
+  std::optional<std::pmr::monotonic_buffer_resource> pool_;
+};
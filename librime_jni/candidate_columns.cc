@@ -0,0 +1,106 @@
+// SPDX-FileCopyrightText: 2015 - 2024 Rime community
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include "candidate_columns.h"
+
+#include <rime/candidate.h>
+#include <rime/composition.h>
+#include <rime/context.h>
+#include <rime/menu.h>
+#include <rime/service.h>
+
+#include <algorithm>
+
+#include "arena.h"
+
+using namespace rime;
+
+namespace {
+
+constexpr int kReserveLimit = 256;
+
+}  // namespace
+
+CandidateColumns::CandidateColumns(std::pmr::memory_resource* resource)
+    : strings(resource),
+      string_offsets(resource),
+      types(resource),
+      type_names(resource),
+      qualities(resource),
+      ranges(resource) {}
+
+CandidateColumns::~CandidateColumns() = default;
+
+void CandidateColumns::addString(std::string_view value) {
+  strings.append(value);
+  string_offsets.push_back(static_cast<int32_t>(strings.size()));
+}
+
+int32_t CandidateColumns::typeIndex(const std::string& type) {
+  auto found = std::find(type_names.begin(), type_names.end(), type);
+  if (found != type_names.end())
+    return static_cast<int32_t>(found - type_names.begin());
+  type_names.push_back(SnapshotArena::copy(type));
+  return static_cast<int32_t>(type_names.size() - 1);
+}
+
+bool CandidateColumns::build(RimeSessionId session_id,
+                             int start_index,
+                             int limit,
+                             uint32_t requested) {
+  fields = requested;
+  session_ = Service::instance().GetSession(session_id);
+  if (!session_)
+    return false;
+  Context* ctx = session_->context();
+  if (!ctx)
+    return false;
+  if (!ctx->HasMenu() || start_index < 0 || limit <= 0)
+    return true;
+  Menu* menu = ctx->composition().back().menu.get();
+  // the menu materializes candidates lazily, up to the last index asked for
+  std::pmr::vector<an<Candidate>> candidates(SnapshotArena::resource());
+  // the limit comes from the caller, the menu may be far shorter
+  candidates.reserve(std::min(limit, kReserveLimit));
+  for (int i = 0; i < limit; ++i) {
+    auto cand = menu->GetCandidateAt(static_cast<size_t>(start_index) + i);
+    if (!cand)
+      break;
+    candidates.push_back(std::move(cand));
+  }
+  count = static_cast<int>(candidates.size());
+
+  bool with_text = fields & kCandidateText;
+  bool with_comment = fields & kCandidateComment;
+  if (with_text || with_comment) {
+    string_offsets.reserve(count * (with_text + with_comment) + 1);
+    string_offsets.push_back(0);
+  }
+  if (with_text) {
+    for (const auto& cand : candidates)
+      addString(cand->text());
+  }
+  if (with_comment) {
+    for (const auto& cand : candidates)
+      addString(cand->comment());
+  }
+  if (fields & kCandidateType) {
+    types.reserve(count);
+    for (const auto& cand : candidates)
+      types.push_back(typeIndex(cand->type()));
+  }
+  if (fields & kCandidateQuality) {
+    qualities.reserve(count);
+    for (const auto& cand : candidates)
+      qualities.push_back(cand->quality());
+  }
+  if (fields & kCandidateRange) {
+    ranges.reserve(count * 2);
+    for (const auto& cand : candidates) {
+      ranges.push_back(static_cast<int32_t>(cand->start()));
+      ranges.push_back(static_cast<int32_t>(cand->end()));
+    }
+  }
+  return true;
+}
@@ -0,0 +1,66 @@
+/*
+ * SPDX-FileCopyrightText: 2015 - 2025 Rime community
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+#pragma once
+
+#include <rime/common.h>
+#include <rime_api.h>
+
+#include <cstdint>
+#include <memory_resource>
+#include <string>
+#include <string_view>
+#include <vector>
+
+//! Fields of getRimeCandidateColumns(), combined into a mask.
+enum CandidateField : uint32_t {
+  kCandidateText = 1 << 0,
+  kCandidateComment = 1 << 1,
+  kCandidateType = 1 << 2,
+  kCandidateQuality = 1 << 3,
+  kCandidateRange = 1 << 4,
+};
+
+namespace rime {
+class Session;
+}  // namespace rime
+
+//! Requested fields of a range of candidates, one packed column per field
+//! instead of an object per candidate. Columns of fields not in the mask
+//! stay empty. Allocated from the given resource, normally the active
+//! SnapshotArena.
+class CandidateColumns {
+ public:
+  explicit CandidateColumns(std::pmr::memory_resource* resource);
+  ~CandidateColumns();
+
+  //! Reads up to `limit` candidates of the current menu from `start_index`.
+  //! Indexes are the ones selectRimeCandidate() takes. Returns false if the
+  //! session or its context is gone.
+  bool build(RimeSessionId session_id,
+             int start_index,
+             int limit,
+             uint32_t fields);
+
+  int count = 0;
+  uint32_t fields = 0;
+
+  //! UTF-8 of the string fields back to back, texts first, then comments.
+  //! String k spans [string_offsets[k], string_offsets[k + 1]); the comment
+  //! of candidate i is string k = count + i when texts were requested too.
+  std::pmr::string strings;
+  std::pmr::vector<int32_t> string_offsets;
+  //! Index into `type_names` per candidate; type names are few and shared.
+  std::pmr::vector<int32_t> types;
+  std::pmr::vector<std::string_view> type_names;
+  std::pmr::vector<double> qualities;
+  //! Start and end of the segment per candidate, in input bytes.
+  std::pmr::vector<int32_t> ranges;
+
+ private:
+  void addString(std::string_view value);
+  int32_t typeIndex(const std::string& type);
+
+  rime::an<rime::Session> session_;
+};
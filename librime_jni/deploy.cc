@@ -0,0 +1,275 @@
+// SPDX-FileCopyrightText: 2015 - 2024 Rime community
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+// Parallel dictionary compilation ahead of the maintenance thread.
+//
+// librime's workspace update compiles the dictionary of every schema in
+// turn. Here the distinct dictionary builds are compiled concurrently
+// first, so that the maintenance run that follows finds most of them up to
+// date. Builds writing any file in common (a dictionary with different
+// prisms or packs, a prism shared by dictionaries) run in the same task, one
+// after another; schemas that reuse a prism with their own algebra still
+// rebuild it during maintenance, as they would without this pass.
+
+#include "deploy.h"
+
+#include <rime/config.h>
+#include <rime/deployer.h>
+#include <rime/dict/dict_compiler.h>
+#include <rime/dict/dictionary.h>
+#include <rime/schema.h>
+#include <rime/service.h>
+#include <rime/ticket.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <filesystem>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <system_error>
+#include <thread>
+
+using namespace rime;
+
+namespace {
+
+// compiling a large table takes a few hundred MB, more workers than this
+// trade memory for little gain on phones
+constexpr int kMaxAutoThreads = 4;
+
+//! One DictCompiler run: a dictionary with the prism and packs of the
+//! first schema configuring it that way.
+struct CompileUnit {
+  std::string dict_name;
+  std::unique_ptr<Schema> schema;
+  std::filesystem::path schema_file;
+  //! Files under build/ that the run writes.
+  std::vector<std::string> outputs;
+};
+
+//! Units sharing outputs, compiled in order on one worker.
+struct CompileTask {
+  std::string name;
+  std::vector<CompileUnit> units;
+  uintmax_t source_size = 0;
+};
+
+struct CompileResult {
+  const CompileTask* task;
+  bool ok;
+  int64_t millis;
+};
+
+std::vector<std::string> packsOf(Config* config) {
+  std::vector<std::string> packs;
+  if (auto list = config->GetList("translator/packs")) {
+    for (size_t i = 0; i < list->size(); ++i) {
+      if (auto value = list->GetValueAt(i))
+        packs.push_back(value->str());
+    }
+  }
+  return packs;
+}
+
+//! Size of the dictionary source, to start the largest ones first.
+uintmax_t sourceSize(const std::string& dict_name) {
+  const Deployer& deployer = Service::instance().deployer();
+  std::error_code ec;
+  for (const auto& dir : {deployer.user_data_dir, deployer.shared_data_dir}) {
+    auto size =
+        std::filesystem::file_size(dir / (dict_name + ".dict.yaml"), ec);
+    if (!ec)
+      return size;
+  }
+  return 0;
+}
+
+int workerCount(int requested, size_t tasks) {
+  int threads = requested;
+  if (threads <= 0) {
+    // leave a core to the UI, the maintenance thread follows anyway
+    int cores = static_cast<int>(std::thread::hardware_concurrency());
+    threads = std::clamp(cores - 1, 1, kMaxAutoThreads);
+  }
+  return std::max(1, std::min(threads, static_cast<int>(tasks)));
+}
+
+size_t findRoot(std::vector<size_t>& parents, size_t i) {
+  while (parents[i] != i)
+    i = parents[i] = parents[parents[i]];
+  return i;
+}
+
+//! One unit per distinct dictionary, prism and packs, grouped into tasks
+//! so that no two tasks write the same file.
+std::vector<CompileTask> collectTasks(const std::vector<std::string>& ids) {
+  Deployer& deployer = Service::instance().deployer();
+  std::vector<CompileUnit> units;
+  std::set<std::string> seen_schemas;
+  std::set<std::string> seen_units;
+  std::deque<std::string> pending(ids.begin(), ids.end());
+  while (!pending.empty()) {
+    std::string schema_id = std::move(pending.front());
+    pending.pop_front();
+    if (!seen_schemas.insert(schema_id).second)
+      continue;
+    // what RimeDeployConfigFile does, the schema is read from the build
+    TaskInitializer args(std::make_pair<string, string>(
+        schema_id + ".schema.yaml", "schema/version"));
+    Service::instance().deployer().RunTask("config_file_update", args);
+    auto schema = std::make_unique<Schema>(schema_id);
+    Config* config = schema->config();
+    if (!config)
+      continue;
+    // reverse lookup and other dependencies are deployed like listed schemas
+    if (auto dependencies = config->GetList("schema/dependencies")) {
+      for (size_t i = 0; i < dependencies->size(); ++i) {
+        if (auto value = dependencies->GetValueAt(i))
+          pending.push_back(value->str());
+      }
+    }
+    std::string dict_name;
+    if (!config->GetString("translator/dictionary", &dict_name) ||
+        dict_name.empty())
+      continue;
+    std::string prism_name;
+    if (!config->GetString("translator/prism", &prism_name) ||
+        prism_name.empty())
+      prism_name = dict_name;
+    std::vector<std::string> packs = packsOf(config);
+    std::string unit_key = dict_name + "/" + prism_name;
+    for (const auto& pack : packs)
+      unit_key += "|" + pack;
+    if (!seen_units.insert(unit_key).second)
+      continue;
+    CompileUnit unit;
+    unit.dict_name = dict_name;
+    unit.schema_file = deployer.staging_dir / (schema_id + ".schema.yaml");
+    unit.outputs = {dict_name + ".table.bin", dict_name + ".reverse.bin",
+                    prism_name + ".prism.bin"};
+    for (const auto& pack : packs)
+      unit.outputs.push_back(pack + ".table.bin");
+    unit.schema = std::move(schema);
+    units.push_back(std::move(unit));
+  }
+
+  // union units over the files they write
+  std::vector<size_t> parents(units.size());
+  for (size_t i = 0; i < units.size(); ++i)
+    parents[i] = i;
+  std::map<std::string, size_t> writers;
+  for (size_t i = 0; i < units.size(); ++i) {
+    for (const auto& output : units[i].outputs) {
+      auto found = writers.emplace(output, i);
+      if (!found.second)
+        parents[findRoot(parents, i)] = findRoot(parents, found.first->second);
+    }
+  }
+  std::vector<CompileTask> tasks;
+  std::map<size_t, size_t> task_of_root;
+  std::set<std::string> sized;
+  for (size_t i = 0; i < units.size(); ++i) {
+    auto slot = task_of_root.emplace(findRoot(parents, i), tasks.size());
+    if (slot.second)
+      tasks.emplace_back();
+    CompileTask& task = tasks[slot.first->second];
+    if (sized.insert(units[i].dict_name).second) {
+      task.source_size += sourceSize(units[i].dict_name);
+      task.name += (task.name.empty() ? "" : "+") + units[i].dict_name;
+    }
+    task.units.push_back(std::move(units[i]));
+  }
+  std::stable_sort(tasks.begin(), tasks.end(),
+                   [](const CompileTask& a, const CompileTask& b) {
+                     return a.source_size > b.source_size;
+                   });
+  return tasks;
+}
+
+bool compile(const CompileUnit& unit) {
+  // a component of its own per unit: the shared one caches prisms and
+  // tables in maps that are not safe to fill from several threads
+  DictionaryComponent component;
+  Ticket ticket(unit.schema.get(), "translator");
+  the<Dictionary> dict(component.Create(ticket));
+  if (!dict)
+    return false;
+  DictCompiler compiler(dict.get());
+  return compiler.Compile(unit.schema_file);
+}
+
+bool compile(const CompileTask& task) {
+  bool ok = true;
+  for (const auto& unit : task.units)
+    ok = compile(unit) && ok;
+  return ok;
+}
+
+}  // namespace
+
+bool compileDictionariesInParallel(const std::vector<std::string>& schema_ids,
+                                   int threads,
+                                   const DeployTaskCallback& on_task_done) {
+  std::vector<CompileTask> tasks = collectTasks(schema_ids);
+  if (tasks.empty())
+    return true;
+  int workers = workerCount(threads, tasks.size());
+  LOG(INFO) << "compiling " << tasks.size() << " dictionary groups on "
+            << workers << " threads";
+
+  std::atomic<size_t> next_task{0};
+  std::mutex mutex;
+  std::condition_variable done;
+  std::deque<CompileResult> results;
+  std::vector<std::thread> pool;
+  for (int i = 0; i < workers; ++i) {
+    pool.emplace_back([&] {
+      size_t index;
+      while ((index = next_task++) < tasks.size()) {
+        const CompileTask& task = tasks[index];
+        auto start = std::chrono::steady_clock::now();
+        bool ok = compile(task);
+        auto millis = std::chrono::duration_cast<std::chrono::milliseconds>(
+                          std::chrono::steady_clock::now() - start)
+                          .count();
+        {
+          std::lock_guard<std::mutex> lock(mutex);
+          results.push_back({&task, ok, static_cast<int64_t>(millis)});
+        }
+        done.notify_one();
+      }
+    });
+  }
+
+  // report from this thread, the workers never touch the notification
+  // handler, which would attach them to the JVM
+  bool success = true;
+  for (size_t reported = 0; reported < tasks.size(); ++reported) {
+    CompileResult result;
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      done.wait(lock, [&] { return !results.empty(); });
+      result = results.front();
+      results.pop_front();
+    }
+    if (!result.ok) {
+      LOG(ERROR) << "error compiling dictionary '" << result.task->name
+                 << "'";
+      success = false;
+    }
+    if (on_task_done) {
+      on_task_done(result.task->name + " " +
+                   std::to_string(result.millis) +
+                   (result.ok ? " ok" : " failed"));
+    }
+  }
+  for (auto& worker : pool)
+    worker.join();
+  return success;
+}
@@ -0,0 +1,22 @@
+/*
+ * SPDX-FileCopyrightText: 2015 - 2025 Rime community
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+#pragma once
+
+#include <functional>
+#include <string>
+#include <vector>
+
+//! Called on the deploying thread as each task finishes, with a value of
+//! the form "<dictionary>[+<dictionary>...] <milliseconds> ok|failed".
+using DeployTaskCallback = std::function<void(const std::string& value)>;
+
+//! Compiles the translator dictionaries of `schema_ids` on up to `threads`
+//! workers, each distinct dictionary/prism/packs build once however many
+//! schemas share it; builds writing the same files share a task. 0 threads
+//! picks a count from the number of cores. Schema configs are compiled on
+//! the way, dependencies included. Returns false if any dictionary failed.
+bool compileDictionariesInParallel(const std::vector<std::string>& schema_ids,
+                                   int threads,
+                                   const DeployTaskCallback& on_task_done);
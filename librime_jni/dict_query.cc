@@ -0,0 +1,191 @@
+// SPDX-FileCopyrightText: 2015 - 2024 Rime community
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+// Read-only dictionary queries for search UIs. A handle loads the
+// dictionary and reverse lookup db a schema uses, the same files as the
+// engines, without creating or touching any session. It goes through
+// components of its own and reads the compiled schema into a config of its
+// own: the registered components, the "schema" config one included, keep
+// caches the engine and maintenance threads fill without a lock.
+
+#include <rime/dict/dictionary.h>
+#include <rime/dict/reverse_lookup_dictionary.h>
+#include <rime/deployer.h>
+#include <rime/schema.h>
+#include <rime/service.h>
+#include <rime/ticket.h>
+
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <mutex>
+
+#include "objconv.h"
+
+using namespace rime;
+
+namespace {
+
+//! The compiled config of `schema_id`, read straight from the build dirs.
+Config* LoadSchemaConfig(const string& schema_id) {
+  const Deployer& deployer = Service::instance().deployer();
+  const string file_name = schema_id + ".schema.yaml";
+  for (const path& dir : {deployer.staging_dir, deployer.prebuilt_data_dir}) {
+    the<Config> config(new Config);
+    if (config->LoadFromFile(dir / file_name))
+      return config.release();
+  }
+  return new Config;
+}
+
+class DictQuery {
+ public:
+  DictQuery(const string& schema_id, const string& name_space)
+      : schema_(schema_id, LoadSchemaConfig(schema_id)) {
+    Ticket ticket(&schema_, name_space);
+    dict_.reset(dict_component_.Create(ticket));
+    if (dict_ && !dict_->Load())
+      dict_.reset();
+    reverse_.reset(reverse_component_.Create(ticket));
+    if (reverse_ && !reverse_->Load())
+      reverse_.reset();
+  }
+
+  bool valid() const { return dict_ || reverse_; }
+
+  //! Starts a new cursor over the entries of `code`, or of every code
+  //! starting with it. Returns the number of codes matched.
+  size_t Lookup(const string& code, bool predictive, size_t expand_limit) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    cursor_ = std::make_unique<DictEntryIterator>();
+    if (!dict_)
+      return 0;
+    return dict_->LookupWords(cursor_.get(), code, predictive, expand_limit);
+  }
+
+  //! Up to `count` more entries from the cursor, text with its code.
+  std::pmr::vector<CandidateItem> Next(size_t count) {
+    std::pmr::vector<CandidateItem> result(SnapshotArena::resource());
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!cursor_)
+      return result;
+    result.reserve(count);
+    std::vector<string> syllables;
+    string code;
+    while (result.size() < count && !cursor_->exhausted()) {
+      if (auto entry = cursor_->Peek()) {
+        code.clear();
+        syllables.clear();
+        if (dict_->Decode(entry->code, &syllables)) {
+          for (const auto& syllable : syllables) {
+            if (!code.empty())
+              code += ' ';
+            code += syllable;
+          }
+        }
+        result.emplace_back(entry->text, code);
+      }
+      cursor_->Next();
+    }
+    return result;
+  }
+
+  //! Space separated codes of `text`, empty if unknown.
+  string ReverseLookup(const string& text) {
+    string result;
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (reverse_)
+      reverse_->ReverseLookup(text, &result);
+    return result;
+  }
+
+ private:
+  Schema schema_;
+  DictionaryComponent dict_component_;
+  ReverseLookupDictionaryComponent reverse_component_;
+  the<Dictionary> dict_;
+  the<ReverseLookupDictionary> reverse_;
+  the<DictEntryIterator> cursor_;
+  std::mutex mutex_;
+};
+
+std::mutex handles_mutex;
+std::map<jlong, std::shared_ptr<DictQuery>> handles;
+jlong next_handle = 1;
+
+std::shared_ptr<DictQuery> findHandle(jlong handle) {
+  std::lock_guard<std::mutex> lock(handles_mutex);
+  auto found = handles.find(handle);
+  return found != handles.end() ? found->second : nullptr;
+}
+
+}  // namespace
+
+//! Returns 0 if the schema has neither a dictionary nor a reverse db.
+extern "C" JNIEXPORT jlong JNICALL
+Java_com_osfans_trime_core_Rime_openRimeDictQuery(JNIEnv* env,
+                                                  jclass /* thiz */,
+                                                  jstring schema_id,
+                                                  jstring name_space) {
+  auto query = std::make_shared<DictQuery>(
+      *CString(env, schema_id),
+      name_space ? *CString(env, name_space) : "translator");
+  if (!query->valid())
+    return 0;
+  std::lock_guard<std::mutex> lock(handles_mutex);
+  jlong handle = next_handle++;
+  handles.emplace(handle, std::move(query));
+  return handle;
+}
+
+extern "C" JNIEXPORT void JNICALL
+Java_com_osfans_trime_core_Rime_closeRimeDictQuery(JNIEnv* env,
+                                                   jclass /* thiz */,
+                                                   jlong handle) {
+  std::lock_guard<std::mutex> lock(handles_mutex);
+  handles.erase(handle);
+}
+
+//! Positions the handle's cursor on the entries of `code`, or with
+//! `predictive` of every code starting with it (at most `expand_limit`
+//! codes, 0 for all). Entries are then fetched with nextRimeDictResults.
+extern "C" JNIEXPORT jint JNICALL
+Java_com_osfans_trime_core_Rime_lookupRimeDict(JNIEnv* env,
+                                               jclass /* thiz */,
+                                               jlong handle,
+                                               jstring code,
+                                               jboolean predictive,
+                                               jint expand_limit) {
+  auto query = findHandle(handle);
+  if (!query)
+    return 0;
+  return static_cast<jint>(query->Lookup(*CString(env, code), predictive,
+                                         std::max(expand_limit, 0)));
+}
+
+//! The next batch of entries as CandidateItem(text, code), empty once the
+//! cursor is exhausted.
+extern "C" JNIEXPORT jobjectArray JNICALL
+Java_com_osfans_trime_core_Rime_nextRimeDictResults(JNIEnv* env,
+                                                    jclass /* thiz */,
+                                                    jlong handle,
+                                                    jint count) {
+  SnapshotArena::Scope scope;
+  std::pmr::vector<CandidateItem> result(SnapshotArena::resource());
+  if (auto query = findHandle(handle))
+    result = query->Next(std::max(count, 0));
+  return rimeCandidateListToJObjectArray(env, result);
+}
+
+extern "C" JNIEXPORT jstring JNICALL
+Java_com_osfans_trime_core_Rime_reverseLookupRimeDict(JNIEnv* env,
+                                                      jclass /* thiz */,
+                                                      jlong handle,
+                                                      jstring text) {
+  auto query = findHandle(handle);
+  if (!query)
+    return nullptr;
+  string codes = query->ReverseLookup(*CString(env, text));
+  return codes.empty() ? nullptr : env->NewStringUTF(codes.c_str());
+}
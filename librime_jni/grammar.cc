@@ -0,0 +1,173 @@
+// SPDX-FileCopyrightText: 2015 - 2024 Rime community
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include "grammar.h"
+
+#include <octagram.h>
+#include <rime/config.h>
+#include <rime/gear/grammar.h>
+#include <rime/registry.h>
+
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <memory>
+#include <mutex>
+
+#include "jni-utils.h"
+
+using namespace rime;
+
+namespace {
+
+// what Grammar::Evaluate adds when a translator has no grammar
+constexpr double kNoGrammarPenalty = -18.420680743952367;
+
+std::atomic<bool> grammar_enabled{true};
+std::atomic<int64_t> live_models{0};
+std::atomic<int64_t> model_loads{0};
+std::atomic<int64_t> load_nanos{0};
+std::atomic<int64_t> last_load_nanos{0};
+std::atomic<int64_t> queries{0};
+std::atomic<int64_t> query_nanos{0};
+
+int64_t nanosSince(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now() - start)
+      .count();
+}
+
+//! The octagram component and the models created from it. Models hold on
+//! to it, so it outlives the registry entry if an engine is still around.
+struct ModelPool {
+  std::mutex mutex;
+  the<OctagramComponent> octagram;
+  std::map<string, std::weak_ptr<Grammar>> models;
+
+  void Release(const string& key, Grammar* grammar) {
+    std::lock_guard<std::mutex> lock(mutex);
+    delete grammar;
+    --live_models;
+    auto found = models.find(key);
+    if (found != models.end() && found->second.expired())
+      models.erase(found);
+    if (models.empty()) {
+      // octagram keeps its gram files mapped as long as it lives
+      octagram.reset();
+    }
+  }
+};
+
+class SharedGrammar : public Grammar {
+ public:
+  explicit SharedGrammar(std::shared_ptr<Grammar> model)
+      : model_(std::move(model)) {}
+
+  double Query(const string& context, const string& word,
+               bool is_rear) override {
+    if (!grammar_enabled.load(std::memory_order_relaxed))
+      return kNoGrammarPenalty;
+    auto start = std::chrono::steady_clock::now();
+    double result = model_->Query(context, word, is_rear);
+    query_nanos.fetch_add(nanosSince(start), std::memory_order_relaxed);
+    queries.fetch_add(1, std::memory_order_relaxed);
+    return result;
+  }
+
+ private:
+  std::shared_ptr<Grammar> model_;
+};
+
+class SharedGrammarComponent : public Grammar::Component {
+ public:
+  SharedGrammarComponent() : pool_(std::make_shared<ModelPool>()) {}
+
+  Grammar* Create(Config* config) override {
+    // librime's own no-grammar path, no model is loaded
+    if (!grammar_enabled.load(std::memory_order_relaxed))
+      return nullptr;
+    string key = ModelKey(config);
+    std::lock_guard<std::mutex> lock(pool_->mutex);
+    std::shared_ptr<Grammar> model = pool_->models[key].lock();
+    if (!model) {
+      if (!pool_->octagram)
+        pool_->octagram.reset(new OctagramComponent);
+      auto start = std::chrono::steady_clock::now();
+      Grammar* grammar = pool_->octagram->Create(config);
+      int64_t nanos = nanosSince(start);
+      if (!grammar) {
+        pool_->models.erase(key);
+        return nullptr;
+      }
+      ++model_loads;
+      ++live_models;
+      load_nanos += nanos;
+      last_load_nanos = nanos;
+      model = std::shared_ptr<Grammar>(
+          grammar, [pool = pool_, key](Grammar* grammar) {
+            pool->Release(key, grammar);
+          });
+      pool_->models[key] = model;
+    }
+    return new SharedGrammar(std::move(model));
+  }
+
+ private:
+  //! Schemas share a model when everything under grammar/ is the same.
+  static string ModelKey(Config* config) {
+    string key;
+    auto settings = config ? config->GetMap("grammar") : nullptr;
+    if (!settings)
+      return key;
+    for (const auto& entry : *settings) {
+      if (auto value = As<ConfigValue>(entry.second)) {
+        key += entry.first;
+        key += '=';
+        key += value->str();
+        key += '\n';
+      }
+    }
+    return key;
+  }
+
+  std::shared_ptr<ModelPool> pool_;
+};
+
+}  // namespace
+
+void installGrammarComponent() {
+  Registry::instance().Register("grammar", new SharedGrammarComponent);
+}
+
+void setGrammarEnabled(bool enabled) {
+  grammar_enabled = enabled;
+}
+
+void collectGrammarStats(int64_t* stats) {
+  stats[kGrammarEnabled] = grammar_enabled ? 1 : 0;
+  stats[kGrammarLiveModels] = live_models;
+  stats[kGrammarLoads] = model_loads;
+  stats[kGrammarLoadNanos] = load_nanos;
+  stats[kGrammarLastLoadNanos] = last_load_nanos;
+  stats[kGrammarQueries] = queries;
+  stats[kGrammarQueryNanos] = query_nanos;
+}
+
+extern "C" JNIEXPORT void JNICALL
+Java_com_osfans_trime_core_Rime_setRimeGrammarEnabled(JNIEnv* env,
+                                                      jclass /* thiz */,
+                                                      jboolean enabled) {
+  setGrammarEnabled(enabled);
+}
+
+extern "C" JNIEXPORT jlongArray JNICALL
+Java_com_osfans_trime_core_Rime_getRimeGrammarStats(JNIEnv* env,
+                                                    jclass /* thiz */) {
+  int64_t stats[kGrammarStatsFieldCount];
+  collectGrammarStats(stats);
+  jlongArray array = env->NewLongArray(kGrammarStatsFieldCount);
+  env->SetLongArrayRegion(array, 0, kGrammarStatsFieldCount,
+                          reinterpret_cast<const jlong*>(stats));
+  return array;
+}
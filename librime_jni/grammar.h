@@ -0,0 +1,34 @@
+/*
+ * SPDX-FileCopyrightText: 2015 - 2025 Rime community
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+#pragma once
+
+#include <cstdint>
+
+//! Layout of the array returned by `Rime.getRimeGrammarStats()`.
+enum GrammarStatsField {
+  kGrammarEnabled = 0,  // 1 or 0
+  kGrammarLiveModels,   // models currently shared by the loaded schemas
+  kGrammarLoads,        // models created so far
+  kGrammarLoadNanos,    // total time spent creating them
+  kGrammarLastLoadNanos,
+  kGrammarQueries,
+  kGrammarQueryNanos,  // total time spent in queries
+  kGrammarStatsFieldCount
+};
+
+//! Replaces the "grammar" component registered by librime-octagram with one
+//! that shares a model between all schemas with the same grammar settings
+//! and unloads it once no schema uses it any more.
+//! Has to be called after every rime initialize().
+void installGrammarComponent();
+
+//! When disabled, engines built from then on get no grammar at all and
+//! load no model. Engines built before answer their queries with the
+//! penalty librime applies without a grammar, until they are rebuilt.
+//! Enabling again likewise reaches the engines built afterwards.
+void setGrammarEnabled(bool enabled);
+
+//! Fills `stats` with kGrammarStatsFieldCount values.
+void collectGrammarStats(int64_t* stats);
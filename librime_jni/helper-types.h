@@ -2,7 +2,9 @@
 
 #include <rime_api.h>
 
+#include <memory_resource>
 #include <string>
+#include <string_view>
 #include <vector>
 
 class SchemaItem {
@@ -26,10 +28,24 @@ class SchemaItem {
 
 class CandidateItem {
  public:
-  std::string text;
-  std::string comment;
+  using allocator_type = std::pmr::polymorphic_allocator<char>;
 
-  explicit CandidateItem(const RimeCandidate& candidate)
-      : text(candidate.text),
-        comment(candidate.comment ? candidate.comment : "") {}
+  std::pmr::string text;
+  std::pmr::string comment;
+
+  CandidateItem(const RimeCandidate& candidate, allocator_type alloc = {})
+      : text(candidate.text, alloc),
+        comment(candidate.comment ? candidate.comment : "", alloc) {}
+
+  CandidateItem(std::string_view text,
+                std::string_view comment,
+                allocator_type alloc = {})
+      : text(text, alloc), comment(comment, alloc) {}
+
+  CandidateItem(const CandidateItem& other, allocator_type alloc)
+      : text(other.text, alloc), comment(other.comment, alloc) {}
+
+  CandidateItem(CandidateItem&& other, allocator_type alloc)
+      : text(std::move(other.text), alloc),
+        comment(std::move(other.comment), alloc) {}
 };
@@ -8,7 +8,13 @@
 #include <jni.h>
 #include <utf8.h>
 
+#include <atomic>
+#include <cstring>
+#include <iterator>
 #include <string>
+#include <string_view>
+
+#include "arena.h"
 
 static inline void throwJavaException(JNIEnv* env, const char* msg) {
   jclass c = env->FindClass("java/lang/Exception");
@@ -56,20 +62,27 @@ class JString {
   JNIEnv* env_;
   jstring jstring_;
 
-  static inline jstring toJString(JNIEnv* env, const char* chars) {
-    if (chars == nullptr)
-      return nullptr;
-    auto u16str = utf8::utf8to16(chars);
+  static inline jstring toJString(JNIEnv* env,
+                                  const char* chars,
+                                  size_t length) {
+    // never longer than the utf-8 input
+    std::pmr::u16string u16str(SnapshotArena::resource());
+    u16str.reserve(length);
+    utf8::utf8to16(chars, chars + length, std::back_inserter(u16str));
     return env->NewString(reinterpret_cast<const jchar*>(u16str.data()),
                           static_cast<int>(u16str.length()));
   }
 
  public:
   JString(JNIEnv* env, const char* chars)
-      : env_(env), jstring_(toJString(env, chars)) {}
+      : env_(env),
+        jstring_(chars ? toJString(env, chars, strlen(chars)) : nullptr) {}
+
+  JString(JNIEnv* env, std::string_view string)
+      : env_(env), jstring_(toJString(env, string.data(), string.size())) {}
 
   JString(JNIEnv* env, const std::string& string)
-      : JString(env, string.c_str()) {}
+      : JString(env, std::string_view(string)) {}
 
   ~JString() { env_->DeleteLocalRef(jstring_); }
 
@@ -123,14 +136,20 @@ class GlobalRefSingleton {
 
   jclass ContextProto;
   jmethodID ContextProtoInit;
+  //! Context with no input, composition or menu, never modified.
+  jobject EmptyContext;
 
   jclass CompositionProto;
   jmethodID CompositionProtoInit;
   jmethodID CompositionProtoDefault;
+  //! Shared by every context without composition, never modified.
+  jobject EmptyComposition;
 
   jclass MenuProto;
   jmethodID MenuProtoInit;
   jmethodID MenuProtoDefault;
+  //! Shared by every context without menu, never modified.
+  jobject EmptyMenu;
 
   jclass StatusProto;
   jmethodID StatusProtoInit;
@@ -141,87 +160,131 @@ class GlobalRefSingleton {
   jclass KeyEvent;
   jmethodID KeyEventInit;
 
+  //! Number of live global references created through this singleton.
+  std::atomic<int> GlobalRefCount{0};
+
   explicit GlobalRefSingleton(JavaVM* jvm_) : jvm(jvm_) {
     JNIEnv* env;
     jvm->AttachCurrentThread(&env, nullptr);
 
-    Object = reinterpret_cast<jclass>(
-        env->NewGlobalRef(env->FindClass("java/lang/Object")));
+    Object = NewGlobalClass(env, "java/lang/Object");
 
-    String = reinterpret_cast<jclass>(
-        env->NewGlobalRef(env->FindClass("java/lang/String")));
+    String = NewGlobalClass(env, "java/lang/String");
 
-    Integer = reinterpret_cast<jclass>(
-        env->NewGlobalRef(env->FindClass("java/lang/Integer")));
+    Integer = NewGlobalClass(env, "java/lang/Integer");
     IntegerInit = env->GetMethodID(Integer, "<init>", "(I)V");
 
-    Boolean = reinterpret_cast<jclass>(
-        env->NewGlobalRef(env->FindClass("java/lang/Boolean")));
+    Boolean = NewGlobalClass(env, "java/lang/Boolean");
     BooleanInit = env->GetMethodID(Boolean, "<init>", "(Z)V");
 
-    Rime = reinterpret_cast<jclass>(
-        env->NewGlobalRef(env->FindClass("com/osfans/trime/core/Rime")));
+    Rime = NewGlobalClass(env, "com/osfans/trime/core/Rime");
     HandleRimeMessage = env->GetStaticMethodID(Rime, "handleRimeMessage",
                                                "(I[Ljava/lang/Object;)V");
 
-    CandidateItem = reinterpret_cast<jclass>(env->NewGlobalRef(
-        env->FindClass("com/osfans/trime/core/CandidateItem")));
+    CandidateItem = NewGlobalClass(env, "com/osfans/trime/core/CandidateItem");
     CandidateItemInit = env->GetMethodID(
         CandidateItem, "<init>", "(Ljava/lang/String;Ljava/lang/String;)V");
 
-    CandidateProto = reinterpret_cast<jclass>(env->NewGlobalRef(
-        env->FindClass("com/osfans/trime/core/RimeProto$Candidate")));
+    CandidateProto =
+        NewGlobalClass(env, "com/osfans/trime/core/RimeProto$Candidate");
     CandidateProtoInit = env->GetMethodID(
         CandidateProto, "<init>",
         "(Ljava/lang/String;Ljava/lang/String;Ljava/lang/String;)V");
 
-    CommitProto = reinterpret_cast<jclass>(env->NewGlobalRef(
-        env->FindClass("com/osfans/trime/core/RimeProto$Commit")));
+    CommitProto = NewGlobalClass(env, "com/osfans/trime/core/RimeProto$Commit");
     CommitProtoInit =
         env->GetMethodID(CommitProto, "<init>", "(Ljava/lang/String;)V");
 
-    ContextProto = reinterpret_cast<jclass>(env->NewGlobalRef(
-        env->FindClass("com/osfans/trime/core/RimeProto$Context")));
+    ContextProto =
+        NewGlobalClass(env, "com/osfans/trime/core/RimeProto$Context");
     ContextProtoInit = env->GetMethodID(
         ContextProto, "<init>",
         "(Lcom/osfans/trime/core/RimeProto$Context$Composition;Lcom/osfans/"
         "trime/core/"
         "RimeProto$Context$Menu;Ljava/lang/String;I)V");
 
-    CompositionProto = reinterpret_cast<jclass>(env->NewGlobalRef(
-        env->FindClass("com/osfans/trime/core/RimeProto$Context$Composition")));
+    CompositionProto = NewGlobalClass(
+        env, "com/osfans/trime/core/RimeProto$Context$Composition");
     CompositionProtoInit =
         env->GetMethodID(CompositionProto, "<init>",
                          "(IIIILjava/lang/String;Ljava/lang/String;)V");
     CompositionProtoDefault =
         env->GetMethodID(CompositionProto, "<init>", "()V");
+    EmptyComposition = NewGlobalObject(env, CompositionProto,
+                                       CompositionProtoDefault);
 
-    MenuProto = reinterpret_cast<jclass>(env->NewGlobalRef(
-        env->FindClass("com/osfans/trime/core/RimeProto$Context$Menu")));
+    MenuProto =
+        NewGlobalClass(env, "com/osfans/trime/core/RimeProto$Context$Menu");
     MenuProtoInit = env->GetMethodID(
         MenuProto, "<init>",
         "(IIZI[Lcom/osfans/trime/core/RimeProto$Candidate;Ljava/lang/"
         "String;[Ljava/lang/String;)V");
     MenuProtoDefault = env->GetMethodID(MenuProto, "<init>", "()V");
+    EmptyMenu = NewGlobalObject(env, MenuProto, MenuProtoDefault);
 
-    StatusProto = reinterpret_cast<jclass>(env->NewGlobalRef(
-        env->FindClass("com/osfans/trime/core/RimeProto$Status")));
+    jstring empty = env->NewStringUTF("");
+    jobject context = env->NewObject(ContextProto, ContextProtoInit,
+                                     EmptyComposition, EmptyMenu, empty, 0);
+    EmptyContext = NewGlobalRef(env, context);
+    env->DeleteLocalRef(context);
+    env->DeleteLocalRef(empty);
+
+    StatusProto = NewGlobalClass(env, "com/osfans/trime/core/RimeProto$Status");
     StatusProtoInit =
         env->GetMethodID(StatusProto, "<init>",
                          "(Ljava/lang/String;Ljava/lang/String;ZZZZZZZ)V");
 
-    SchemaListItem = reinterpret_cast<jclass>(
-        env->NewGlobalRef(env->FindClass("com/osfans/trime/core/SchemaItem")));
+    SchemaListItem = NewGlobalClass(env, "com/osfans/trime/core/SchemaItem");
     SchemaListItemInit = env->GetMethodID(
         SchemaListItem, "<init>", "(Ljava/lang/String;Ljava/lang/String;)V");
 
-    KeyEvent = reinterpret_cast<jclass>(env->NewGlobalRef(
-        env->FindClass("com/osfans/trime/core/RimeKeyEvent")));
+    KeyEvent = NewGlobalClass(env, "com/osfans/trime/core/RimeKeyEvent");
     KeyEventInit =
         env->GetMethodID(KeyEvent, "<init>", "(IILjava/lang/String;)V");
   }
 
   [[nodiscard]] JEnv AttachEnv() const { return JEnv(jvm); }
+
+  jobject NewGlobalRef(JNIEnv* env, jobject ref) {
+    ++GlobalRefCount;
+    return env->NewGlobalRef(ref);
+  }
+
+  void DeleteGlobalRef(JNIEnv* env, jobject ref) {
+    --GlobalRefCount;
+    env->DeleteGlobalRef(ref);
+  }
+
+ private:
+  jclass NewGlobalClass(JNIEnv* env, const char* name) {
+    return reinterpret_cast<jclass>(NewGlobalRef(env, env->FindClass(name)));
+  }
+
+  jobject NewGlobalObject(JNIEnv* env, jclass clazz, jmethodID init) {
+    jobject object = env->NewObject(clazz, init);
+    jobject ref = NewGlobalRef(env, object);
+    env->DeleteLocalRef(object);
+    return ref;
+  }
 };
 
 extern GlobalRefSingleton* GlobalRef;
+
+//! Message types understood by Rime.handleRimeMessage().
+enum RimeMessageType {
+  kUnknownMessage = 0,
+  kSchemaMessage = 1,
+  kOptionMessage = 2,
+  kDeployMessage = 3,
+  kPredictMessage = 4,
+  kLuaMessage = 5,
+  kUserDbMessage = 6,
+  kDeployTaskMessage = 7,
+};
+
+inline void postRimeMessage(JNIEnv* env,
+                            RimeMessageType type,
+                            jobjectArray args) {
+  env->CallStaticVoidMethod(GlobalRef->Rime, GlobalRef->HandleRimeMessage,
+                            static_cast<jint>(type), args);
+}
@@ -0,0 +1,92 @@
+// SPDX-FileCopyrightText: 2015 - 2024 Rime community
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include "key_result.h"
+
+#include <rime/context.h>
+#include <rime/schema.h>
+#include <rime/service.h>
+
+using namespace rime;
+
+KeyResultTracker::~KeyResultTracker() {
+  reset();
+}
+
+void KeyResultTracker::reset() {
+  // safe on a destroyed context, the signal tracks its connections
+  update_connection_.disconnect();
+  option_connection_.disconnect();
+  context_ = nullptr;
+  session_id_ = 0;
+  tracking_ = false;
+  schema_ = nullptr;
+}
+
+void KeyResultTracker::watch(Context* context) {
+  // a new context may reuse the address of a destroyed one, whose
+  // signal dropped our connections with it
+  if (context == context_ && update_connection_.connected())
+    return;
+  update_connection_.disconnect();
+  option_connection_.disconnect();
+  context_ = context;
+  if (!context)
+    return;
+  update_connection_ = context->update_notifier().connect([this](Context*) {
+    if (tracking_)
+      changes_ |= kCompositionChanged;
+  });
+  option_connection_ = context->option_update_notifier().connect(
+      [this](Context*, const string&) {
+        if (tracking_)
+          changes_ |= kStatusChanged;
+      });
+}
+
+void KeyResultTracker::begin(RimeSessionId session_id) {
+  session_id_ = session_id;
+  changes_ = 0;
+  an<Session> session = Service::instance().GetSession(session_id);
+  Context* context = session ? session->context() : nullptr;
+  watch(context);
+  tracking_ = context != nullptr;
+  if (!context)
+    return;
+  composing_ = context->IsComposing();
+  has_menu_ = context->HasMenu();
+  schema_ = session->schema();
+}
+
+int KeyResultTracker::end(bool handled) {
+  int result = handled ? kKeyHandled : 0;
+  if (!tracking_) {
+    // nothing to compare against, report everything
+    return result | kKeyCommitted | kCompositionChanged | kMenuChanged |
+           kStatusChanged;
+  }
+  tracking_ = false;
+  result |= changes_;
+  an<Session> session = Service::instance().GetSession(session_id_);
+  Context* context = session ? session->context() : nullptr;
+  if (!context || context != context_) {
+    return result | kKeyCommitted | kCompositionChanged | kMenuChanged |
+           kStatusChanged;
+  }
+  if (!session->commit_text().empty())
+    result |= kKeyCommitted;
+  bool has_menu = context->HasMenu();
+  bool composing = context->IsComposing();
+  if ((changes_ & kCompositionChanged) && (has_menu_ || has_menu))
+    result |= kMenuChanged;
+  if ((changes_ & kCompositionChanged) && !composing && !has_menu) {
+    // emptied, mostly by a commit; there is nothing left to fetch
+    result &= ~(kCompositionChanged | kMenuChanged);
+    result |= kCompositionCleared;
+  }
+  // the status carries the composing state and the schema besides options
+  if (composing_ != composing || schema_ != session->schema())
+    result |= kStatusChanged;
+  return result;
+}
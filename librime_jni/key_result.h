@@ -0,0 +1,57 @@
+/*
+ * SPDX-FileCopyrightText: 2015 - 2025 Rime community
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+#pragma once
+
+#include <rime/common.h>
+#include <rime_api.h>
+
+namespace rime {
+class Context;
+class Schema;
+}  // namespace rime
+
+//! Bits returned by processRimeKeyWithResult(). Only kCompositionChanged
+//! and kMenuChanged call for getRimeContext(); a key committing the
+//! composition, such as space on the first candidate, reports
+//! kKeyCommitted | kCompositionCleared and the frontend just reads the
+//! commit and hides the preedit and menu.
+enum KeyResultFlag {
+  kKeyHandled = 1 << 0,
+  kKeyCommitted = 1 << 1,
+  kCompositionChanged = 1 << 2,  // changed and not empty
+  kMenuChanged = 1 << 3,         // likewise, the menu
+  kStatusChanged = 1 << 4,
+  kCompositionCleared = 1 << 5,  // changed to no composition and no menu
+};
+
+//! Collects the context notifications of a session around one key.
+//! Connects once per context and stays connected until reset().
+class KeyResultTracker {
+ public:
+  KeyResultTracker() = default;
+  KeyResultTracker(const KeyResultTracker&) = delete;
+  void operator=(const KeyResultTracker&) = delete;
+  ~KeyResultTracker();
+
+  void begin(RimeSessionId session_id);
+  //! KeyResultFlag bits for the key processed since begin().
+  int end(bool handled);
+  //! Forgets the watched context, before its sessions are destroyed.
+  void reset();
+
+ private:
+  void watch(rime::Context* context);
+
+  RimeSessionId session_id_ = 0;
+  rime::Context* context_ = nullptr;
+  rime::connection update_connection_;
+  rime::connection option_connection_;
+
+  bool tracking_ = false;
+  int changes_ = 0;
+  bool composing_ = false;
+  bool has_menu_ = false;
+  rime::Schema* schema_ = nullptr;
+};
@@ -0,0 +1,422 @@
+// SPDX-FileCopyrightText: 2015 - 2024 Rime community
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include "lua_profiler.h"
+
+#include <lua_gears.h>
+#include <rime/filter.h>
+#include <rime/processor.h>
+#include <rime/registry.h>
+#include <rime/segmentor.h>
+#include <rime/translation.h>
+#include <rime/translator.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <mutex>
+
+#include "jni-utils.h"
+#include "memory.h"
+
+using namespace rime;
+
+namespace {
+
+std::atomic<uint64_t> keystroke{0};
+std::atomic<int64_t> budget_nanos{0};
+std::atomic<int> max_strikes{3};
+// bumped by setLuaTimeBudget() to lift earlier penalties
+std::atomic<uint64_t> budget_generation{0};
+
+void postLuaMessage(const string& name, const char* event, int64_t nanos) {
+  if (!GlobalRef)
+    return;
+  auto env = GlobalRef->AttachEnv();
+  auto args = JRef<jobjectArray>(
+      env, env->NewObjectArray(3, GlobalRef->Object, nullptr));
+  env->SetObjectArrayElement(args, 0, JString(env, name));
+  env->SetObjectArrayElement(args, 1, JString(env, event));
+  env->SetObjectArrayElement(args, 2,
+                             JString(env, std::to_string(nanos / 1000)));
+  postRimeMessage(env, kLuaMessage, args);
+}
+
+//! Counters of one Lua component, shared by every engine using it. The
+//! budget state is only touched from the thread processing keys.
+class LuaStats {
+ public:
+  explicit LuaStats(string name) : name_(std::move(name)) {}
+
+  //! Whether the component may run now.
+  bool Admit() {
+    uint64_t generation = budget_generation.load(std::memory_order_relaxed);
+    if (generation != generation_) {
+      generation_ = generation;
+      strikes_ = 0;
+      disabled_ = false;
+    }
+    uint64_t current = keystroke.load(std::memory_order_relaxed);
+    if (current != keystroke_) {
+      if (!over_)
+        strikes_ = 0;
+      keystroke_ = current;
+      keystroke_nanos_ = 0;
+      over_ = false;
+    }
+    return !disabled_ && !over_;
+  }
+
+  //! Times `call`; the heap is sampled on one call in kHeapSampleInterval
+  //! since asking the interpreter costs about as much as a short script.
+  template <typename Call>
+  auto Measure(Call&& call) {
+    bool sample = sample_tick_++ % kHeapSampleInterval == 0;
+    int64_t heap = sample ? luaHeapUsage() : 0;
+    struct Record {
+      LuaStats* stats;
+      bool sample;
+      int64_t heap;
+      int64_t excluded;
+      std::chrono::steady_clock::time_point start;
+      ~Record() {
+        auto nanos = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                         std::chrono::steady_clock::now() - start)
+                         .count();
+        nanos -= stats->excluded_nanos_ - excluded;
+        int64_t growth =
+            sample ? (luaHeapUsage() - heap) * kHeapSampleInterval : 0;
+        stats->Add(nanos, growth);
+      }
+    } record{this, sample, heap, excluded_nanos_,
+             std::chrono::steady_clock::now()};
+    return call();
+  }
+
+  //! Runs `call` inside a measured one without charging its time, for the
+  //! upstream translation a filter pulls from.
+  template <typename Call>
+  auto Exclude(Call&& call) {
+    struct Record {
+      LuaStats* stats;
+      std::chrono::steady_clock::time_point start;
+      ~Record() {
+        stats->excluded_nanos_ +=
+            std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - start)
+                .count();
+      }
+    } record{this, std::chrono::steady_clock::now()};
+    return call();
+  }
+
+  LuaComponentStats Snapshot() const {
+    LuaComponentStats result;
+    result.name = name_;
+    result.calls = calls_;
+    result.total_nanos = total_nanos_;
+    result.max_nanos = max_nanos_;
+    result.heap_bytes = heap_bytes_;
+    result.overruns = overruns_;
+    result.disabled = disabled_;
+    return result;
+  }
+
+ private:
+  void Add(int64_t nanos, int64_t heap_growth) {
+    calls_.fetch_add(1, std::memory_order_relaxed);
+    total_nanos_.fetch_add(nanos, std::memory_order_relaxed);
+    if (nanos > max_nanos_.load(std::memory_order_relaxed))
+      max_nanos_.store(nanos, std::memory_order_relaxed);
+    if (heap_growth > 0)
+      heap_bytes_.fetch_add(heap_growth, std::memory_order_relaxed);
+    keystroke_nanos_ += nanos;
+    int64_t budget = budget_nanos.load(std::memory_order_relaxed);
+    if (budget <= 0 || over_ || keystroke_nanos_ <= budget)
+      return;
+    over_ = true;
+    overruns_.fetch_add(1, std::memory_order_relaxed);
+    if (++strikes_ >= max_strikes.load(std::memory_order_relaxed)) {
+      disabled_ = true;
+      LOG(WARNING) << "lua component " << name_ << " disabled after "
+                   << strikes_ << " overruns";
+      postLuaMessage(name_, "disabled", keystroke_nanos_);
+    } else {
+      postLuaMessage(name_, "overrun", keystroke_nanos_);
+    }
+  }
+
+  const string name_;
+  std::atomic<int64_t> calls_{0};
+  std::atomic<int64_t> total_nanos_{0};
+  std::atomic<int64_t> max_nanos_{0};
+  std::atomic<int64_t> heap_bytes_{0};
+  std::atomic<int64_t> overruns_{0};
+  std::atomic<bool> disabled_{false};
+
+  static constexpr int kHeapSampleInterval = 16;
+
+  uint64_t generation_ = 0;
+  uint64_t keystroke_ = 0;
+  uint64_t sample_tick_ = 0;
+  int64_t excluded_nanos_ = 0;
+  int64_t keystroke_nanos_ = 0;
+  int strikes_ = 0;
+  bool over_ = false;
+};
+
+std::mutex stats_mutex;
+std::map<string, an<LuaStats>> all_stats;
+
+an<LuaStats> StatsFor(const Ticket& ticket) {
+  string name = ticket.klass + "@" + ticket.name_space;
+  std::lock_guard<std::mutex> lock(stats_mutex);
+  auto& stats = all_stats[name];
+  if (!stats)
+    stats = New<LuaStats>(name);
+  return stats;
+}
+
+//! Lua translations are lazy, the script mostly runs while the menu pulls
+//! candidates. Once the component goes over budget the rest of the
+//! translation is passed through unmeasured, since cutting it short would
+//! end the whole menu when it comes from a filter.
+class ProfiledTranslation : public Translation {
+ public:
+  ProfiledTranslation(an<Translation> inner, an<LuaStats> stats)
+      : inner_(std::move(inner)), stats_(std::move(stats)) {
+    set_exhausted(inner_->exhausted());
+  }
+
+  bool Next() override {
+    if (exhausted())
+      return false;
+    bool result = stats_->Admit()
+                      ? stats_->Measure([this] { return inner_->Next(); })
+                      : inner_->Next();
+    set_exhausted(inner_->exhausted());
+    return result;
+  }
+
+  an<Candidate> Peek() override {
+    if (exhausted())
+      return nullptr;
+    auto result = stats_->Admit()
+                      ? stats_->Measure([this] { return inner_->Peek(); })
+                      : inner_->Peek();
+    set_exhausted(inner_->exhausted());
+    return result;
+  }
+
+ private:
+  an<Translation> inner_;
+  an<LuaStats> stats_;
+};
+
+//! The input of a Lua filter: time spent pulling it belongs to the
+//! translators and filters upstream, not to the filter.
+class UpstreamTranslation : public Translation {
+ public:
+  UpstreamTranslation(an<Translation> inner, an<LuaStats> stats)
+      : inner_(std::move(inner)), stats_(std::move(stats)) {
+    set_exhausted(inner_->exhausted());
+  }
+
+  bool Next() override {
+    if (exhausted())
+      return false;
+    bool result = stats_->Exclude([this] { return inner_->Next(); });
+    set_exhausted(inner_->exhausted());
+    return result;
+  }
+
+  an<Candidate> Peek() override {
+    if (exhausted())
+      return nullptr;
+    auto result = stats_->Exclude([this] { return inner_->Peek(); });
+    set_exhausted(inner_->exhausted());
+    return result;
+  }
+
+ private:
+  an<Translation> inner_;
+  an<LuaStats> stats_;
+};
+
+an<Translation> Profile(an<Translation> translation,
+                        const an<LuaStats>& stats) {
+  if (!translation)
+    return translation;
+  return New<ProfiledTranslation>(std::move(translation), stats);
+}
+
+class ProfiledProcessor : public Processor {
+ public:
+  ProfiledProcessor(const Ticket& ticket,
+                    the<Processor> inner,
+                    an<LuaStats> stats)
+      : Processor(ticket), inner_(std::move(inner)), stats_(std::move(stats)) {}
+
+  ProcessResult ProcessKeyEvent(const KeyEvent& key_event) override {
+    if (!stats_->Admit())
+      return kNoop;
+    return stats_->Measure(
+        [&] { return inner_->ProcessKeyEvent(key_event); });
+  }
+
+ private:
+  the<Processor> inner_;
+  an<LuaStats> stats_;
+};
+
+class ProfiledSegmentor : public Segmentor {
+ public:
+  ProfiledSegmentor(const Ticket& ticket,
+                    the<Segmentor> inner,
+                    an<LuaStats> stats)
+      : Segmentor(ticket), inner_(std::move(inner)), stats_(std::move(stats)) {}
+
+  bool Proceed(Segmentation* segmentation) override {
+    if (!stats_->Admit())
+      return true;
+    return stats_->Measure([&] { return inner_->Proceed(segmentation); });
+  }
+
+ private:
+  the<Segmentor> inner_;
+  an<LuaStats> stats_;
+};
+
+class ProfiledTranslator : public Translator {
+ public:
+  ProfiledTranslator(const Ticket& ticket,
+                     the<Translator> inner,
+                     an<LuaStats> stats)
+      : Translator(ticket),
+        inner_(std::move(inner)),
+        stats_(std::move(stats)) {}
+
+  an<Translation> Query(const string& input, const Segment& segment) override {
+    if (!stats_->Admit())
+      return nullptr;
+    return Profile(
+        stats_->Measure([&] { return inner_->Query(input, segment); }),
+        stats_);
+  }
+
+ private:
+  the<Translator> inner_;
+  an<LuaStats> stats_;
+};
+
+class ProfiledFilter : public Filter {
+ public:
+  ProfiledFilter(const Ticket& ticket, the<Filter> inner, an<LuaStats> stats)
+      : Filter(ticket), inner_(std::move(inner)), stats_(std::move(stats)) {}
+
+  //! A filter over budget lets the candidates through unfiltered.
+  an<Translation> Apply(an<Translation> translation,
+                        CandidateList* candidates) override {
+    if (!stats_->Admit() || !translation)
+      return translation;
+    auto upstream = New<UpstreamTranslation>(translation, stats_);
+    auto result = stats_->Measure(
+        [&] { return inner_->Apply(upstream, candidates); });
+    return result == upstream ? translation : Profile(result, stats_);
+  }
+
+  bool AppliesToSegment(Segment* segment) override {
+    return stats_->Measure([&] { return inner_->AppliesToSegment(segment); });
+  }
+
+ private:
+  the<Filter> inner_;
+  an<LuaStats> stats_;
+};
+
+template <class T, class Profiled>
+class ProfiledComponent : public T::Component {
+ public:
+  explicit ProfiledComponent(typename T::Component* inner) : inner_(inner) {}
+
+  T* Create(const Ticket& ticket) override {
+    T* gear = inner_->Create(ticket);
+    if (!gear)
+      return nullptr;
+    return new Profiled(ticket, the<T>(gear), StatsFor(ticket));
+  }
+
+ private:
+  the<typename T::Component> inner_;
+};
+
+template <class T, class LuaGear, class Profiled>
+void Wrap(const string& name) {
+  Registry& registry = Registry::instance();
+  auto* lua = dynamic_cast<LuaComponent<LuaGear>*>(registry.Find(name));
+  if (!lua)  // librime-lua not loaded, or already wrapped
+    return;
+  // Register() deletes the original, keep a copy sharing its interpreter
+  auto* inner = new LuaComponent<LuaGear>(*lua);
+  registry.Register(name, new ProfiledComponent<T, Profiled>(inner));
+}
+
+}  // namespace
+
+void installLuaProfiler() {
+  Wrap<Processor, LuaProcessor, ProfiledProcessor>("lua_processor");
+  Wrap<Segmentor, LuaSegmentor, ProfiledSegmentor>("lua_segmentor");
+  Wrap<Translator, LuaTranslator, ProfiledTranslator>("lua_translator");
+  Wrap<Filter, LuaFilter, ProfiledFilter>("lua_filter");
+}
+
+void beginLuaKeystroke() {
+  keystroke.fetch_add(1, std::memory_order_relaxed);
+}
+
+void setLuaTimeBudget(int64_t budget_micros, int strikes) {
+  budget_nanos = budget_micros * 1000;
+  max_strikes = std::max(strikes, 1);
+  ++budget_generation;
+}
+
+std::vector<LuaComponentStats> luaComponentStats() {
+  std::vector<LuaComponentStats> result;
+  std::lock_guard<std::mutex> lock(stats_mutex);
+  result.reserve(all_stats.size());
+  for (const auto& stats : all_stats) {
+    result.push_back(stats.second->Snapshot());
+  }
+  return result;
+}
+
+extern "C" JNIEXPORT void JNICALL
+Java_com_osfans_trime_core_Rime_setRimeLuaTimeBudget(JNIEnv* env,
+                                                     jclass /* thiz */,
+                                                     jlong budget_micros,
+                                                     jint max_strikes) {
+  setLuaTimeBudget(budget_micros, max_strikes);
+}
+
+//! One line per component: "<calls> <total us> <max us> <heap bytes>
+//! <overruns> <disabled> <name>".
+extern "C" JNIEXPORT jobjectArray JNICALL
+Java_com_osfans_trime_core_Rime_getRimeLuaStats(JNIEnv* env,
+                                                jclass /* thiz */) {
+  auto stats = luaComponentStats();
+  jobjectArray array = env->NewObjectArray(static_cast<int>(stats.size()),
+                                           GlobalRef->String, nullptr);
+  int i = 0;
+  for (const auto& item : stats) {
+    string line = std::to_string(item.calls) + " " +
+                  std::to_string(item.total_nanos / 1000) + " " +
+                  std::to_string(item.max_nanos / 1000) + " " +
+                  std::to_string(item.heap_bytes) + " " +
+                  std::to_string(item.overruns) + " " +
+                  (item.disabled ? "1 " : "0 ") + item.name;
+    env->SetObjectArrayElement(array, i++, *JString(env, line));
+  }
+  return array;
+}
@@ -0,0 +1,38 @@
+/*
+ * SPDX-FileCopyrightText: 2015 - 2025 Rime community
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+struct LuaComponentStats {
+  std::string name;  // e.g. "lua_filter@my_filter"
+  int64_t calls = 0;
+  int64_t total_nanos = 0;
+  int64_t max_nanos = 0;
+  int64_t heap_bytes = 0;  // growth of the Lua heap during calls, sampled
+  int64_t overruns = 0;    // keystrokes in which it exceeded the budget
+  bool disabled = false;
+};
+
+//! Wraps the lua_processor, lua_segmentor, lua_translator and lua_filter
+//! components registered by librime-lua so that every call is measured.
+//! Has to be called after every rime initialize().
+void installLuaProfiler();
+
+//! Starts a new keystroke for the time budget. Called before every request
+//! that may run Lua components: keys, paging, selection and candidate reads.
+void beginLuaKeystroke();
+
+//! Time a single Lua component may spend per keystroke, 0 for no limit.
+//! A filter's time excludes pulling the candidates of the components before
+//! it. A component over budget is skipped for the rest of the keystroke,
+//! translations it already returned run on unmeasured; after
+//! `max_strikes` consecutive overruns it is skipped until the budget is set
+//! again. Both events are posted as a kLuaMessage.
+void setLuaTimeBudget(int64_t budget_micros, int max_strikes);
+
+std::vector<LuaComponentStats> luaComponentStats();
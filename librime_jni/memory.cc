@@ -0,0 +1,272 @@
+// SPDX-FileCopyrightText: 2015 - 2024 Rime community
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include "memory.h"
+
+#include <malloc.h>
+#include <quickjs.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <mutex>
+
+#include "jni-utils.h"
+#include "userdb.h"
+
+// librime-lua and librime-qjs keep their interpreters private, so their
+// constructors are wrapped at link time (see CMakeLists.txt) to let us ask
+// the interpreters for their own heap counters.
+struct lua_State;
+
+extern "C" {
+lua_State* __real_luaL_newstate();
+void __real_lua_close(lua_State* L);
+int lua_gc(lua_State* L, int what, ...);
+
+JSRuntime* __real_JS_NewRuntime();
+void __real_JS_FreeRuntime(JSRuntime* rt);
+}
+
+namespace {
+
+constexpr int LUA_GCCOUNT = 3;
+constexpr int LUA_GCCOUNTB = 4;
+
+std::mutex interpreters_mutex;
+std::vector<lua_State*> lua_states;
+std::vector<JSRuntime*> qjs_runtimes;
+
+// last values seen on the engine thread, read from any thread
+std::atomic<int64_t> lua_heap_sample{-1};
+std::atomic<int64_t> qjs_heap_sample{-1};
+std::chrono::steady_clock::time_point qjs_sampled_at;
+
+template <typename T>
+void forget(std::vector<T*>& list, T* item, std::atomic<int64_t>& sample) {
+  std::lock_guard<std::mutex> lock(interpreters_mutex);
+  list.erase(std::remove(list.begin(), list.end(), item), list.end());
+  if (list.empty())
+    sample = -1;
+}
+
+int64_t luaHeap() {
+  std::lock_guard<std::mutex> lock(interpreters_mutex);
+  if (lua_states.empty())
+    return -1;
+  int64_t total = 0;
+  for (auto* L : lua_states) {
+    total += int64_t{lua_gc(L, LUA_GCCOUNT, 0)} * 1024;
+    total += lua_gc(L, LUA_GCCOUNTB, 0);
+  }
+  return total;
+}
+
+int64_t qjsHeap() {
+  std::lock_guard<std::mutex> lock(interpreters_mutex);
+  if (qjs_runtimes.empty())
+    return -1;
+  int64_t total = 0;
+  for (auto* rt : qjs_runtimes) {
+    JSMemoryUsage usage{};
+    JS_ComputeMemoryUsage(rt, &usage);
+    total += usage.malloc_size;
+  }
+  return total;
+}
+
+enum class MappingKind { kOther, kDict, kUserDb, kOpencc, kGrammar, kPredict };
+
+bool endsWith(const std::string& str, const char* suffix) {
+  size_t len = strlen(suffix);
+  return str.size() >= len && str.compare(str.size() - len, len, suffix) == 0;
+}
+
+MappingKind classify(const std::string& path) {
+  if (path.find(".userdb/") != std::string::npos)
+    return MappingKind::kUserDb;
+  if (endsWith(path, ".table.bin") || endsWith(path, ".prism.bin") ||
+      endsWith(path, ".reverse.bin"))
+    return MappingKind::kDict;
+  if (endsWith(path, ".ocd2") || endsWith(path, ".ocd"))
+    return MappingKind::kOpencc;
+  if (endsWith(path, ".gram"))
+    return MappingKind::kGrammar;
+  if (endsWith(path, ".db"))
+    return MappingKind::kPredict;
+  return MappingKind::kOther;
+}
+
+int64_t residentSetSize() {
+  FILE* fp = fopen("/proc/self/statm", "r");
+  if (!fp)
+    return -1;
+  long pages = 0, resident = 0;
+  int n = fscanf(fp, "%ld %ld", &pages, &resident);
+  fclose(fp);
+  return n == 2 ? int64_t{resident} * sysconf(_SC_PAGESIZE) : -1;
+}
+
+}  // namespace
+
+extern "C" lua_State* __wrap_luaL_newstate() {
+  lua_State* L = __real_luaL_newstate();
+  if (L) {
+    std::lock_guard<std::mutex> lock(interpreters_mutex);
+    lua_states.push_back(L);
+  }
+  return L;
+}
+
+extern "C" void __wrap_lua_close(lua_State* L) {
+  forget(lua_states, L, lua_heap_sample);
+  __real_lua_close(L);
+}
+
+extern "C" JSRuntime* __wrap_JS_NewRuntime() {
+  JSRuntime* rt = __real_JS_NewRuntime();
+  if (rt) {
+    std::lock_guard<std::mutex> lock(interpreters_mutex);
+    qjs_runtimes.push_back(rt);
+  }
+  return rt;
+}
+
+extern "C" void __wrap_JS_FreeRuntime(JSRuntime* rt) {
+  forget(qjs_runtimes, rt, qjs_heap_sample);
+  __real_JS_FreeRuntime(rt);
+}
+
+std::vector<MappedFileUsage> mappedFileUsage() {
+  std::vector<MappedFileUsage> result;
+  FILE* fp = fopen("/proc/self/smaps", "r");
+  if (!fp)
+    return result;
+  std::map<std::string, MappedFileUsage> files;
+  MappedFileUsage* current = nullptr;
+  char line[4096];
+  while (fgets(line, sizeof(line), fp)) {
+    unsigned long start, end;
+    int path_offset = 0;
+    if (sscanf(line, "%lx-%lx %*s %*s %*s %*s %n", &start, &end,
+               &path_offset) == 2) {
+      current = nullptr;
+      char* path = line + path_offset;
+      path[strcspn(path, "\n")] = '\0';
+      if (path[0] == '/') {
+        current = &files[path];
+        current->path = path;
+      }
+      continue;
+    }
+    if (!current)
+      continue;
+    long kb = 0;
+    if (sscanf(line, "Size: %ld kB", &kb) == 1) {
+      current->mapped += int64_t{kb} * 1024;
+    } else if (sscanf(line, "Rss: %ld kB", &kb) == 1) {
+      current->resident += int64_t{kb} * 1024;
+    }
+  }
+  fclose(fp);
+  result.reserve(files.size());
+  for (auto& entry : files) {
+    result.emplace_back(std::move(entry.second));
+  }
+  return result;
+}
+
+void collectMemoryUsage(int64_t* usage) {
+  std::fill(usage, usage + kMemoryUsageFieldCount, 0);
+#if defined(__GLIBC__) && \
+    (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+  usage[kNativeHeap] = static_cast<int64_t>(mallinfo2().uordblks);
+#else
+  // bionic has no mallinfo2(), its mallinfo() reports size_t already
+  usage[kNativeHeap] = static_cast<int64_t>(mallinfo().uordblks);
+#endif
+  usage[kResidentSet] = residentSetSize();
+  for (const auto& file : mappedFileUsage()) {
+    int field;
+    switch (classify(file.path)) {
+      case MappingKind::kDict:
+        field = kDictMapped;
+        break;
+      case MappingKind::kUserDb:
+        field = kUserDbMapped;
+        break;
+      case MappingKind::kOpencc:
+        field = kOpenccMapped;
+        break;
+      case MappingKind::kGrammar:
+        field = kGrammarMapped;
+        break;
+      case MappingKind::kPredict:
+        field = kPredictMapped;
+        break;
+      default:
+        continue;
+    }
+    usage[field] += file.mapped;
+    usage[field + 1] += file.resident;
+  }
+  usage[kLuaHeap] = lua_heap_sample;
+  usage[kQjsHeap] = qjs_heap_sample;
+  usage[kJniGlobalRefs] = GlobalRef ? GlobalRef->GlobalRefCount.load() : 0;
+  usage[kUserDbCache] = userDbMemoryUsage();
+}
+
+void sampleInterpreterHeaps() {
+  lua_heap_sample = luaHeap();
+  // unlike the Lua counter, QuickJS walks every object to add them up
+  auto now = std::chrono::steady_clock::now();
+  if (now - qjs_sampled_at < std::chrono::seconds(1))
+    return;
+  qjs_sampled_at = now;
+  qjs_heap_sample = qjsHeap();
+}
+
+int64_t luaHeapUsage() {
+  return luaHeap();
+}
+
+extern "C" JNIEXPORT jlongArray JNICALL
+Java_com_osfans_trime_core_Rime_getRimeMemoryUsage(JNIEnv* env,
+                                                   jclass /* thiz */) {
+  int64_t usage[kMemoryUsageFieldCount];
+  collectMemoryUsage(usage);
+  jlongArray array = env->NewLongArray(kMemoryUsageFieldCount);
+  env->SetLongArrayRegion(array, 0, kMemoryUsageFieldCount,
+                          reinterpret_cast<const jlong*>(usage));
+  return array;
+}
+
+//! Per-file breakdown as "<mapped> <resident> <path>", to find out which
+//! schema or plugin owns a mapping.
+extern "C" JNIEXPORT jobjectArray JNICALL
+Java_com_osfans_trime_core_Rime_getRimeMappedFiles(JNIEnv* env,
+                                                   jclass /* thiz */) {
+  std::vector<MappedFileUsage> files = mappedFileUsage();
+  files.erase(std::remove_if(files.begin(), files.end(),
+                             [](const MappedFileUsage& file) {
+                               return classify(file.path) ==
+                                      MappingKind::kOther;
+                             }),
+              files.end());
+  jobjectArray array = env->NewObjectArray(static_cast<int>(files.size()),
+                                           GlobalRef->String, nullptr);
+  int i = 0;
+  for (const auto& file : files) {
+    char prefix[48];
+    snprintf(prefix, sizeof(prefix), "%" PRId64 " %" PRId64 " ", file.mapped,
+             file.resident);
+    env->SetObjectArrayElement(array, i++, *JString(env, prefix + file.path));
+  }
+  return array;
+}
@@ -0,0 +1,53 @@
+/*
+ * SPDX-FileCopyrightText: 2015 - 2025 Rime community
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+//! Layout of the array returned by `Rime.getRimeMemoryUsage()`, in bytes
+//! unless noted otherwise. A value of -1 means the subsystem is not loaded.
+enum MemoryUsageField {
+  kNativeHeap = 0,
+  kResidentSet,
+  kDictMapped,  // *.table.bin, *.prism.bin, *.reverse.bin
+  kDictResident,
+  kUserDbMapped,  // files inside *.userdb
+  kUserDbResident,
+  kOpenccMapped,  // *.ocd2, *.ocd
+  kOpenccResident,
+  kGrammarMapped,  // *.gram
+  kGrammarResident,
+  kPredictMapped,  // predict.db and friends
+  kPredictResident,
+  kLuaHeap,
+  kQjsHeap,
+  kJniGlobalRefs,  // count
+  kUserDbCache,    // block cache and memtables of open userdbs
+  kMemoryUsageFieldCount
+};
+
+struct MappedFileUsage {
+  std::string path;
+  int64_t mapped = 0;
+  int64_t resident = 0;
+};
+
+//! File-backed mappings of this process, merged by path.
+std::vector<MappedFileUsage> mappedFileUsage();
+
+//! Fills `usage` with kMemoryUsageFieldCount values. The interpreter heaps
+//! are the ones last recorded by sampleInterpreterHeaps().
+void collectMemoryUsage(int64_t* usage);
+
+//! Records the heaps of the Lua and QuickJS interpreters. Has to run on the
+//! thread processing keys, which is the only one allowed to touch them;
+//! QuickJS is walked at most once a second.
+void sampleInterpreterHeaps();
+
+//! Bytes held by all Lua interpreters, -1 if none is alive. Same thread as
+//! sampleInterpreterHeaps().
+int64_t luaHeapUsage();
@@ -6,6 +6,7 @@
 
 #include <rime_api.h>
 
+#include "candidate_columns.h"
 #include "helper-types.h"
 #include "jni-utils.h"
 
@@ -50,7 +51,7 @@ inline jobject rimeCandidateItemToJObject(JNIEnv* env,
 
 inline jobjectArray rimeCandidateListToJObjectArray(
     JNIEnv* env,
-    const std::vector<CandidateItem>& list) {
+    const std::pmr::vector<CandidateItem>& list) {
   jobjectArray array = env->NewObjectArray(static_cast<int>(list.size()),
                                            GlobalRef->CandidateItem, nullptr);
   int i = 0;
@@ -60,3 +61,53 @@ inline jobjectArray rimeCandidateListToJObjectArray(
   }
   return array;
 }
+
+//! Packs CandidateColumns as Object[]{int[]{count, fields}, byte[] strings,
+//! int[] string offsets, int[] types, String[] type names, double[]
+//! qualities, int[] ranges}, null for the columns not requested.
+inline jobjectArray candidateColumnsToJObjectArray(
+    JNIEnv* env,
+    const CandidateColumns& columns) {
+  jobjectArray array = env->NewObjectArray(7, GlobalRef->Object, nullptr);
+  auto intArray = [env](const std::pmr::vector<int32_t>& values) {
+    jintArray result = env->NewIntArray(static_cast<jsize>(values.size()));
+    env->SetIntArrayRegion(result, 0, static_cast<jsize>(values.size()),
+                           values.data());
+    return result;
+  };
+  const jint header[] = {columns.count, static_cast<jint>(columns.fields)};
+  auto jHeader = JRef<jintArray>(env, env->NewIntArray(2));
+  env->SetIntArrayRegion(jHeader, 0, 2, header);
+  env->SetObjectArrayElement(array, 0, jHeader);
+  if (!columns.string_offsets.empty()) {
+    auto size = static_cast<jsize>(columns.strings.size());
+    auto jStrings = JRef<jbyteArray>(env, env->NewByteArray(size));
+    env->SetByteArrayRegion(
+        jStrings, 0, size,
+        reinterpret_cast<const jbyte*>(columns.strings.data()));
+    env->SetObjectArrayElement(array, 1, jStrings);
+    env->SetObjectArrayElement(array, 2,
+                               JRef(env, intArray(columns.string_offsets)));
+  }
+  if (columns.fields & kCandidateType) {
+    env->SetObjectArrayElement(array, 3, JRef(env, intArray(columns.types)));
+    auto names = JRef<jobjectArray>(
+        env,
+        env->NewObjectArray(static_cast<jsize>(columns.type_names.size()),
+                            GlobalRef->String, nullptr));
+    for (size_t i = 0; i < columns.type_names.size(); ++i) {
+      env->SetObjectArrayElement(names, static_cast<jsize>(i),
+                                 JString(env, columns.type_names[i]));
+    }
+    env->SetObjectArrayElement(array, 4, names);
+  }
+  if (columns.fields & kCandidateQuality) {
+    auto size = static_cast<jsize>(columns.qualities.size());
+    auto jQualities = JRef<jdoubleArray>(env, env->NewDoubleArray(size));
+    env->SetDoubleArrayRegion(jQualities, 0, size, columns.qualities.data());
+    env->SetObjectArrayElement(array, 5, jQualities);
+  }
+  if (columns.fields & kCandidateRange)
+    env->SetObjectArrayElement(array, 6, JRef(env, intArray(columns.ranges)));
+  return array;
+}
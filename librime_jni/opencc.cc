@@ -9,6 +9,7 @@
 #include <string>
 
 #include "jni-utils.h"
+#include "page_filter.h"
 
 // opencc
 
@@ -19,8 +20,8 @@ Java_com_osfans_trime_data_opencc_OpenCCDictManager_openCCLineConv(
     jstring input,
     jstring config_file_name) {
   try {
-    opencc::SimpleConverter converter(CString(env, config_file_name));
-    return env->NewStringUTF(converter.Convert(*CString(env, input)).data());
+    auto converter = cachedOpenccConverter(CString(env, config_file_name));
+    return env->NewStringUTF(converter->Convert(*CString(env, input)).data());
   } catch (const opencc::Exception& e) {
     throwJavaException(env, e.what());
     return env->NewStringUTF("");
@@ -42,6 +43,7 @@ Java_com_osfans_trime_data_opencc_OpenCCDictManager_openCCDictConv(
     } else {
       opencc::ConvertDictionary(src_file, dest_file, "text", "ocd2");
     }
+    clearOpenccConverters();
   } catch (const opencc::Exception& e) {
     throwJavaException(env, e.what());
   }
@@ -0,0 +1,178 @@
+// SPDX-FileCopyrightText: 2015 - 2024 Rime community
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include "page_filter.h"
+
+#include <opencc/Exception.hpp>
+#include <opencc/SimpleConverter.hpp>
+#include <rime/candidate.h>
+#include <rime/component.h>
+#include <rime/filter.h>
+#include <rime/registry.h>
+#include <rime/translation.h>
+
+#include <map>
+#include <mutex>
+#include <set>
+
+#include "jni-utils.h"
+
+using namespace rime;
+
+namespace {
+
+// same quotes as librime's simplifier tips
+constexpr char kQuoteLeft[] = "\xe3\x80\x94";   // 〔
+constexpr char kQuoteRight[] = "\xe3\x80\x95";  // 〕
+
+struct ActiveFilter {
+  PageFilterOptions options;
+  std::shared_ptr<const opencc::SimpleConverter> converter;
+};
+
+std::mutex converters_mutex;
+std::map<std::string, std::shared_ptr<const opencc::SimpleConverter>>
+    converters;
+
+std::mutex filter_mutex;
+std::shared_ptr<const ActiveFilter> active_filter;
+
+std::shared_ptr<const ActiveFilter> activeFilter() {
+  std::lock_guard<std::mutex> lock(filter_mutex);
+  return active_filter;
+}
+
+//! Converts and dedupes lazily, one candidate ahead of the menu.
+class PageFilterTranslation : public Translation {
+ public:
+  PageFilterTranslation(an<Translation> inner,
+                        std::shared_ptr<const ActiveFilter> filter)
+      : inner_(std::move(inner)), filter_(std::move(filter)) {
+    Fill();
+  }
+
+  bool Next() override {
+    if (!next_)
+      return false;
+    next_.reset();
+    Fill();
+    return true;
+  }
+
+  an<Candidate> Peek() override { return next_; }
+
+ private:
+  void Fill() {
+    while (!next_ && !inner_->exhausted()) {
+      auto candidate = inner_->Peek();
+      inner_->Next();
+      if (!candidate)
+        continue;
+      candidate = Convert(candidate);
+      if (filter_->options.dedupe && !seen_.insert(candidate->text()).second)
+        continue;
+      next_ = candidate;
+    }
+    set_exhausted(!next_);
+  }
+
+  an<Candidate> Convert(const an<Candidate>& candidate) {
+    if (!filter_->converter)
+      return candidate;
+    const string& original = candidate->text();
+    string converted;
+    try {
+      converted = filter_->converter->Convert(original);
+    } catch (const opencc::Exception& e) {
+      LOG(ERROR) << "opencc error: " << e.what();
+      return candidate;
+    }
+    if (converted == original)
+      return candidate;
+    string comment;
+    if (filter_->options.annotate)
+      comment = candidate->comment() + kQuoteLeft + original + kQuoteRight;
+    return New<ShadowCandidate>(candidate, candidate->type(), converted,
+                                comment);
+  }
+
+  an<Translation> inner_;
+  std::shared_ptr<const ActiveFilter> filter_;
+  an<Candidate> next_;
+  std::set<string> seen_;
+};
+
+//! Runs inside the engine, so the committed text, the preedit and the
+//! select keys all see the converted, deduplicated menu.
+class PageFilter : public Filter {
+ public:
+  explicit PageFilter(const Ticket& ticket) : Filter(ticket) {}
+
+  an<Translation> Apply(an<Translation> translation,
+                        CandidateList* candidates) override {
+    auto filter = activeFilter();
+    if (!filter || !translation)
+      return translation;
+    return New<PageFilterTranslation>(std::move(translation),
+                                      std::move(filter));
+  }
+
+  bool AppliesToSegment(Segment* segment) override { return true; }
+};
+
+}  // namespace
+
+std::shared_ptr<const opencc::SimpleConverter> cachedOpenccConverter(
+    const std::string& config) {
+  std::lock_guard<std::mutex> lock(converters_mutex);
+  auto found = converters.find(config);
+  if (found != converters.end())
+    return found->second;
+  auto converter = std::make_shared<const opencc::SimpleConverter>(config);
+  converters.emplace(config, converter);
+  return converter;
+}
+
+void clearOpenccConverters() {
+  std::lock_guard<std::mutex> lock(converters_mutex);
+  converters.clear();
+}
+
+void setPageFilterOptions(const PageFilterOptions& options) {
+  std::shared_ptr<ActiveFilter> filter;
+  if (!options.opencc_config.empty() || options.dedupe) {
+    filter = std::make_shared<ActiveFilter>();
+    filter->options = options;
+    if (!options.opencc_config.empty()) {
+      try {
+        filter->converter = cachedOpenccConverter(options.opencc_config);
+      } catch (const opencc::Exception& e) {
+        LOG(ERROR) << "error loading opencc config " << options.opencc_config
+                   << ": " << e.what();
+      }
+    }
+  }
+  std::lock_guard<std::mutex> lock(filter_mutex);
+  active_filter = std::move(filter);
+}
+
+void installPageFilterComponent() {
+  Registry::instance().Register("trime_page_filter",
+                                new Component<PageFilter>);
+}
+
+extern "C" JNIEXPORT void JNICALL
+Java_com_osfans_trime_core_Rime_setRimeCandidatePostProcess(
+    JNIEnv* env,
+    jclass /* thiz */,
+    jstring opencc_config,
+    jboolean dedupe,
+    jboolean annotate) {
+  PageFilterOptions options;
+  if (opencc_config)
+    options.opencc_config = *CString(env, opencc_config);
+  options.dedupe = dedupe;
+  options.annotate = annotate;
+  setPageFilterOptions(options);
+}
@@ -0,0 +1,38 @@
+/*
+ * SPDX-FileCopyrightText: 2015 - 2025 Rime community
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+#pragma once
+
+#include <memory>
+#include <string>
+
+namespace opencc {
+class SimpleConverter;
+}
+
+//! Converter for an OpenCC config, built once and shared afterwards.
+//! Throws opencc::Exception if the config cannot be loaded.
+std::shared_ptr<const opencc::SimpleConverter> cachedOpenccConverter(
+    const std::string& config);
+
+//! Forgets the cached converters, e.g. after their dictionaries changed.
+//! Converters in use stay alive until released.
+void clearOpenccConverters();
+
+struct PageFilterOptions {
+  std::string opencc_config;  // empty for no conversion
+  bool dedupe = false;        // drop candidates repeating an earlier text
+  bool annotate = false;      // put the unconverted text in the comment
+};
+
+//! Options of every trime_page_filter, taking effect with the next menu.
+void setPageFilterOptions(const PageFilterOptions& options);
+
+//! Registers the "trime_page_filter" filter, which converts and dedupes
+//! candidates in a single pass inside the engine, so that committing,
+//! the preedit and the select keys agree with what is shown. A schema
+//! enables it like any filter, e.g. by patching
+//! `engine/filters/+: [trime_page_filter]`. Has to be called after every
+//! rime initialize().
+void installPageFilterComponent();
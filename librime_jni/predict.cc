@@ -0,0 +1,258 @@
+// SPDX-FileCopyrightText: 2015 - 2024 Rime community
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include "predict.h"
+
+#include <predict_db.h>
+#include <rime/deployer.h>
+#include <rime/service.h>
+
+#include <condition_variable>
+#include <deque>
+#include <filesystem>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+
+#include "objconv.h"
+
+using namespace rime;
+
+namespace {
+
+constexpr size_t kCacheCapacity = 64;
+// per context, larger limits are capped
+constexpr size_t kMaxPredictions = 32;
+// the db is keyed by words, longer contexts are matched by their tail
+constexpr size_t kMaxKeyLength = 8;
+
+struct PredictRequest {
+  int id;
+  std::vector<std::string> contexts;
+  size_t limit;
+};
+
+//! Byte offsets of the last `max_chars` utf-8 characters of `text`,
+//! longest suffix first.
+std::vector<size_t> suffixOffsets(const std::string& text, size_t max_chars) {
+  std::vector<size_t> offsets;
+  for (size_t i = text.size(); i > 0 && offsets.size() < max_chars;) {
+    --i;
+    if ((static_cast<unsigned char>(text[i]) & 0xC0) != 0x80)
+      offsets.push_back(i);
+  }
+  return {offsets.rbegin(), offsets.rend()};
+}
+
+class PredictionService {
+ public:
+  static PredictionService& instance() {
+    static PredictionService service;
+    return service;
+  }
+
+  int Enqueue(std::vector<std::string> contexts, int limit) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    int id = next_id_++;
+    queue_.push_back(
+        {id, std::move(contexts),
+         std::min(static_cast<size_t>(std::max(limit, 0)), kMaxPredictions)});
+    if (!worker_.joinable()) {
+      stopping_ = false;
+      worker_ = std::thread(&PredictionService::Run, this);
+    }
+    wakeup_.notify_one();
+    return id;
+  }
+
+  void SetDbName(std::string name) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    db_name_ = std::move(name);
+    reset_ = true;
+  }
+
+  void Reset() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    reset_ = true;
+  }
+
+  void Stop() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stopping_ = true;
+      queue_.clear();
+      reset_ = true;
+    }
+    wakeup_.notify_one();
+    if (worker_.joinable())
+      worker_.join();
+  }
+
+ private:
+  //! Shared so that results of a batch survive eviction from the cache
+  //! until they are posted.
+  using Predictions = std::shared_ptr<const std::vector<std::string>>;
+  using CacheEntry = std::pair<std::string, Predictions>;
+
+  void Run() {
+    bool attached = false;
+    while (true) {
+      PredictRequest request;
+      std::string db_name;
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        wakeup_.wait(lock, [this] { return stopping_ || !queue_.empty(); });
+        if (reset_) {
+          db_.reset();
+          db_opened_ = false;
+          lru_.clear();
+          index_.clear();
+          reset_ = false;
+        }
+        if (stopping_)
+          break;
+        request = std::move(queue_.front());
+        queue_.pop_front();
+        db_name = db_name_;
+      }
+      if (!db_opened_) {
+        db_ = OpenDb(db_name);
+        db_opened_ = true;
+      }
+      std::vector<Predictions> results;
+      results.reserve(request.contexts.size());
+      for (const auto& context : request.contexts) {
+        results.push_back(Predict(context));
+      }
+      Post(request, results);
+      attached = true;
+    }
+    if (attached)
+      GlobalRef->jvm->DetachCurrentThread();
+  }
+
+  static an<PredictDb> OpenDb(const std::string& name) {
+    const Deployer& deployer = Service::instance().deployer();
+    for (const path& dir :
+         {path(deployer.user_data_dir), path(deployer.shared_data_dir)}) {
+      path file = dir / name;
+      if (!std::filesystem::exists(file))
+        continue;
+      auto db = New<PredictDb>(file);
+      if (db->Load())
+        return db;
+      LOG(ERROR) << "error loading predict db: " << file;
+    }
+    return nullptr;
+  }
+
+  Predictions Predict(const std::string& context) {
+    static const Predictions kNone =
+        std::make_shared<const std::vector<std::string>>();
+    if (!db_ || context.empty())
+      return kNone;
+    auto offsets = suffixOffsets(context, kMaxKeyLength);
+    std::string window = context.substr(offsets.front());
+    auto cached = index_.find(window);
+    if (cached != index_.end()) {
+      lru_.splice(lru_.begin(), lru_, cached->second);
+      return cached->second->second;
+    }
+    std::vector<std::string> predictions;
+    for (size_t offset : offsets) {
+      auto* candidates = db_->Lookup(context.substr(offset));
+      if (!candidates)
+        continue;
+      for (auto it = candidates->begin();
+           it != candidates->end() && predictions.size() < kMaxPredictions;
+           ++it) {
+        predictions.push_back(db_->GetEntryText(*it));
+      }
+      break;
+    }
+    auto shared = std::make_shared<const std::vector<std::string>>(
+        std::move(predictions));
+    lru_.emplace_front(window, shared);
+    index_[window] = lru_.begin();
+    if (lru_.size() > kCacheCapacity) {
+      index_.erase(lru_.back().first);
+      lru_.pop_back();
+    }
+    return shared;
+  }
+
+  static void Post(const PredictRequest& request,
+                   const std::vector<Predictions>& results) {
+    auto env = GlobalRef->AttachEnv();
+    // this thread never returns to java, local refs have to go explicitly
+    env->PushLocalFrame(static_cast<jint>(results.size() + 4));
+    jobjectArray args = env->NewObjectArray(
+        static_cast<jint>(results.size() + 1), GlobalRef->Object, nullptr);
+    env->SetObjectArrayElement(
+        args, 0, JString(env, std::to_string(request.id)));
+    for (size_t i = 0; i < results.size(); ++i) {
+      const auto& predictions = *results[i];
+      size_t count = std::min(predictions.size(), request.limit);
+      auto texts = JRef<jobjectArray>(
+          env, env->NewObjectArray(static_cast<jint>(count), GlobalRef->String,
+                                   nullptr));
+      for (size_t j = 0; j < count; ++j) {
+        env->SetObjectArrayElement(texts, j, JString(env, predictions[j]));
+      }
+      env->SetObjectArrayElement(args, i + 1, texts);
+    }
+    postRimeMessage(env, kPredictMessage, args);
+    env->PopLocalFrame(nullptr);
+  }
+
+  std::mutex mutex_;
+  std::condition_variable wakeup_;
+  std::deque<PredictRequest> queue_;
+  std::thread worker_;
+  std::string db_name_ = "predict.db";
+  int next_id_ = 1;
+  bool stopping_ = false;
+  bool reset_ = false;
+
+  // owned by the worker
+  an<PredictDb> db_;
+  bool db_opened_ = false;
+  std::list<CacheEntry> lru_;
+  std::unordered_map<std::string, std::list<CacheEntry>::iterator> index_;
+};
+
+}  // namespace
+
+int queryPredictions(std::vector<std::string> contexts, int limit) {
+  return PredictionService::instance().Enqueue(std::move(contexts), limit);
+}
+
+void setPredictDbName(std::string name) {
+  PredictionService::instance().SetDbName(std::move(name));
+}
+
+void resetPredictions() {
+  PredictionService::instance().Reset();
+}
+
+void stopPredictions() {
+  PredictionService::instance().Stop();
+}
+
+extern "C" JNIEXPORT jint JNICALL
+Java_com_osfans_trime_core_Rime_queryRimePredictions(JNIEnv* env,
+                                                     jclass /* thiz */,
+                                                     jobjectArray contexts,
+                                                     jint limit) {
+  return queryPredictions(stringArrayToStringVector(env, contexts), limit);
+}
+
+extern "C" JNIEXPORT void JNICALL
+Java_com_osfans_trime_core_Rime_setRimePredictDb(JNIEnv* env,
+                                                 jclass /* thiz */,
+                                                 jstring file_name) {
+  setPredictDbName(CString(env, file_name));
+}
@@ -0,0 +1,24 @@
+/*
+ * SPDX-FileCopyrightText: 2015 - 2025 Rime community
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+#pragma once
+
+#include <string>
+#include <vector>
+
+//! Looks up next-word predictions for each of `contexts` on the prediction
+//! thread, at most `limit` per context. Results are posted as a
+//! kPredictMessage with args `[id, String[] for contexts[0], ...]`, `id`
+//! being the decimal form of the returned request id.
+int queryPredictions(std::vector<std::string> contexts, int limit);
+
+//! Selects the database file, looked up in the user data dir first and
+//! then in the shared data dir. Defaults to "predict.db".
+void setPredictDbName(std::string name);
+
+//! Closes the database and drops cached results, e.g. after a deployment.
+void resetPredictions();
+
+//! Stops the prediction thread, pending queries are dropped.
+void stopPredictions();
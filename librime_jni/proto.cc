@@ -1,19 +1,36 @@
 #include "proto.h"
 
 #include <rime/component.h>
-#include <rime/composition.h>
 #include <rime/context.h>
-#include <rime/menu.h>
 #include <rime/schema.h>
 #include <rime/service.h>
 #include <rime_api.h>
 
+#include <atomic>
+
 #include "jni-utils.h"
+#include "snapshot.h"
 
 using namespace rime;
 
+namespace {
+
+//! The last status object handed out, returned again until a schema or
+//! option notification invalidates it, or the session, composing state or
+//! service state it was built for changes.
+struct StatusCache {
+  std::atomic<bool> valid{false};
+  jobject status = nullptr;
+  RimeSessionId session_id = 0;
+  bool composing = false;
+  bool disabled = false;
+} status_cache;
+
+}  // namespace
+
 void rime_commit_proto(RimeSessionId session_id,
                        RIME_PROTO_BUILDER* commit_builder) {
+  SnapshotArena::Scope scope;
   an<Session> session(Service::instance().GetSession(session_id));
   if (!session)
     return;
@@ -29,87 +46,67 @@ void rime_commit_proto(RimeSessionId session_id,
 
 void rime_context_proto(RimeSessionId session_id,
                         RIME_PROTO_BUILDER* context_builder) {
-  an<Session> session = Service::instance().GetSession(session_id);
-  if (!session)
-    return;
-  Context* ctx = session->context();
-  if (!ctx)
+  SnapshotArena::Scope scope;
+  ContextSnapshot snapshot(SnapshotArena::resource());
+  if (!snapshot.build(session_id))
     return;
   auto env = GlobalRef->AttachEnv();
   auto* context = (jobject*)context_builder;
-  jobject composition = env->NewObject(GlobalRef->CompositionProto,
-                                       GlobalRef->CompositionProtoDefault);
-  if (ctx->IsComposing()) {
-    const Preedit& preedit = ctx->GetPreedit();
+  if (!snapshot.composing && !snapshot.has_menu && snapshot.input.empty()) {
+    // the state after every plain commit
+    *context = env->NewLocalRef(GlobalRef->EmptyContext);
+    return;
+  }
+  jobject composition;
+  if (snapshot.composing) {
     composition = env->NewObject(
         GlobalRef->CompositionProto, GlobalRef->CompositionProtoInit,
-        preedit.text.length(), preedit.caret_pos, preedit.sel_start,
-        preedit.sel_end, *JString(env, preedit.text),
-        *JString(env, ctx->GetCommitText()));
+        (jint)snapshot.preedit.length(), (jint)snapshot.caret_pos,
+        (jint)snapshot.sel_start, (jint)snapshot.sel_end,
+        *JString(env, snapshot.preedit),
+        *JString(env, snapshot.commit_text_preview));
+  } else {
+    composition = env->NewLocalRef(GlobalRef->EmptyComposition);
   }
-  jobject menu =
-      env->NewObject(GlobalRef->MenuProto, GlobalRef->MenuProtoDefault);
-  if (ctx->HasMenu()) {
-    Segment& seg = ctx->composition().back();
-    Schema* schema = session->schema();
-    int page_size = schema ? schema->page_size() : 5;
-    int selected_index = seg.selected_index;
-    int page_number = selected_index / page_size;
-    int highlighted_index = selected_index % page_size;
-    const string& select_keys = schema ? schema->select_keys() : "";
-    the<Page> page(seg.menu->CreatePage(page_size, page_number));
-    if (page) {
-      vector<string> labels;
-      auto dest_labels =
-          env->NewObjectArray(page_size, GlobalRef->String, nullptr);
-      if (schema) {
-        Config* config = schema->config();
-        auto src_labels = config->GetList("menu/alternative_select_labels");
-        if (src_labels && (size_t)page_size <= src_labels->size()) {
-          for (int i = 0; i < page_size; ++i) {
-            if (an<ConfigValue> value = src_labels->GetValueAt(i)) {
-              env->SetObjectArrayElement(dest_labels, i,
-                                         *JString(env, value->str()));
-              labels.emplace_back(value->str());
-            }
-          }
-        } else if (!select_keys.empty()) {
-          for (const char key : select_keys) {
-            labels.emplace_back(1, key);
-            if (labels.size() >= page_size)
-              break;
-          }
-        }
-      }
-      int num_candidates = page->candidates.size();
-      auto dest_candidates = env->NewObjectArray(
-          num_candidates, GlobalRef->CandidateProto, nullptr);
-      int index = 0;
-      for (const an<Candidate>& src : page->candidates) {
-        const string& label =
-            index < labels.size() ? labels[index] : std::to_string(index + 1);
-        auto dest = JRef(env, env->NewObject(GlobalRef->CandidateProto,
-                                             GlobalRef->CandidateProtoInit,
-                                             *JString(env, src->text()),
-                                             *JString(env, src->comment()),
-                                             *JString(env, label)));
-        env->SetObjectArrayElement(dest_candidates, index++, *dest);
-      }
-      menu = env->NewObject(
-          GlobalRef->MenuProto, GlobalRef->MenuProtoInit, page_size,
-          page_number, page->is_last_page, highlighted_index,
-          *JRef<jobjectArray>(env, dest_candidates), *JString(env, select_keys),
-          *JRef<jobjectArray>(env, dest_labels));
+  jobject menu;
+  if (snapshot.has_menu) {
+    auto dest_labels =
+        env->NewObjectArray(snapshot.page_size, GlobalRef->String, nullptr);
+    for (size_t i = 0; i < snapshot.select_labels.size(); ++i) {
+      if (snapshot.select_labels[i].data())
+        env->SetObjectArrayElement(dest_labels, i,
+                                   *JString(env, snapshot.select_labels[i]));
     }
+    auto dest_candidates = env->NewObjectArray(
+        snapshot.candidates.size(), GlobalRef->CandidateProto, nullptr);
+    int index = 0;
+    for (const auto& src : snapshot.candidates) {
+      auto dest = JRef(env, env->NewObject(GlobalRef->CandidateProto,
+                                           GlobalRef->CandidateProtoInit,
+                                           *JString(env, src.text),
+                                           *JString(env, src.comment),
+                                           *JString(env, src.label)));
+      env->SetObjectArrayElement(dest_candidates, index++, *dest);
+    }
+    menu = env->NewObject(GlobalRef->MenuProto, GlobalRef->MenuProtoInit,
+                          snapshot.page_size, snapshot.page_number,
+                          snapshot.is_last_page, snapshot.highlighted_index,
+                          *JRef<jobjectArray>(env, dest_candidates),
+                          *JString(env, snapshot.select_keys),
+                          *JRef<jobjectArray>(env, dest_labels));
+  } else {
+    menu = env->NewLocalRef(GlobalRef->EmptyMenu);
   }
-  *context =
-      env->NewObject(GlobalRef->ContextProto, GlobalRef->ContextProtoInit,
-                     *JRef(env, composition), *JRef(env, menu),
-                     *JString(env, ctx->input()), ctx->caret_pos());
+  *context = env->NewObject(GlobalRef->ContextProto,
+                            GlobalRef->ContextProtoInit,
+                            *JRef(env, composition), *JRef(env, menu),
+                            *JString(env, snapshot.input),
+                            (jint)snapshot.input_caret_pos);
 }
 
 void rime_status_proto(RimeSessionId session_id,
                        RIME_PROTO_BUILDER* status_builder) {
+  SnapshotArena::Scope scope;
   an<Session> session(Service::instance().GetSession(session_id));
   if (!session)
     return;
@@ -119,13 +116,31 @@ void rime_status_proto(RimeSessionId session_id,
     return;
   auto env = GlobalRef->AttachEnv();
   auto* status = (jobject*)status_builder;
+  bool disabled = Service::instance().disabled();
+  bool composing = ctx->IsComposing();
+  if (status_cache.valid && status_cache.session_id == session_id &&
+      status_cache.disabled == disabled &&
+      status_cache.composing == composing) {
+    *status = env->NewLocalRef(status_cache.status);
+    return;
+  }
   *status = env->NewObject(
       GlobalRef->StatusProto, GlobalRef->StatusProtoInit,
       *JString(env, schema->schema_id()), *JString(env, schema->schema_name()),
-      Service::instance().disabled(), ctx->IsComposing(),
-      ctx->get_option("ascii_mode"), ctx->get_option("full_shape"),
-      ctx->get_option("simplification"), ctx->get_option("traditional"),
-      ctx->get_option("ascii_punct"));
+      disabled, composing, ctx->get_option("ascii_mode"),
+      ctx->get_option("full_shape"), ctx->get_option("simplification"),
+      ctx->get_option("traditional"), ctx->get_option("ascii_punct"));
+  if (status_cache.status)
+    GlobalRef->DeleteGlobalRef(env, status_cache.status);
+  status_cache.status = GlobalRef->NewGlobalRef(env, *status);
+  status_cache.session_id = session_id;
+  status_cache.disabled = disabled;
+  status_cache.composing = composing;
+  status_cache.valid = true;
+}
+
+void rime_invalidate_status() {
+  status_cache.valid = false;
 }
 
 static void rime_proto_initialize() {}
@@ -139,6 +154,7 @@ static RimeCustomApi* rime_proto_get_api() {
     s_api.commit_proto = &rime_commit_proto;
     s_api.context_proto = &rime_context_proto;
     s_api.status_proto = &rime_status_proto;
+    s_api.invalidate_status = &rime_invalidate_status;
   }
   return (RimeCustomApi*)&s_api;
 }
@@ -18,6 +18,9 @@ typedef struct rime_proto_api_t {
                         RIME_PROTO_BUILDER* context_builder);
   void (*status_proto)(RimeSessionId session_id,
                        RIME_PROTO_BUILDER* status_builder);
+  //! Drops the status object cached by status_proto. To be called on schema
+  //! and option notifications.
+  void (*invalidate_status)(void);
 } RimeProtoApi;
 
 #ifdef __cplusplus
@@ -0,0 +1,316 @@
+// SPDX-FileCopyrightText: 2015 - 2024 Rime community
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+// Bytecode cache for the JavaScript modules of librime-qjs.
+//
+// The plugin compiles every module from source whenever an engine loads it.
+// JS_SetModuleLoaderFunc() is wrapped at link time (see CMakeLists.txt) to
+// put a caching loader in front of the one the plugin installs; --wrap only
+// redirects references between objects, so the plugin's own loader cannot
+// be wrapped directly. Modules found under the qjs base folder are compiled
+// once and the bytecode is kept as <module hash>-<source hash>.qbc in a
+// directory the frontend names; storing a module drops the files of its
+// older sources. Anything else (node_modules lookups, unreadable cache
+// files) goes to the plugin's loader.
+//
+// JS_ReadObject() trusts its input, so bytecode anyone else can write would
+// run arbitrary code in the IME. The cache is off until the frontend gives
+// it a directory in app-private storage, never the user data dir, which is
+// often shared storage; files not owned by us or writable by others are
+// ignored as well.
+
+#include <fcntl.h>
+#include <quickjs.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "qjs_cache.h"
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <mutex>
+#include <string>
+#include <system_error>
+
+#include "jni-utils.h"
+
+namespace fs = std::filesystem;
+
+extern "C" {
+void __real_JS_SetModuleLoaderFunc(JSRuntime* rt,
+                                   JSModuleNormalizeFunc* module_normalize,
+                                   JSModuleLoaderFunc* module_loader,
+                                   void* opaque);
+void __real_setQjsBaseFolder(const char* path);
+}
+
+namespace {
+
+// bump when the cache layout or key changes
+constexpr uint64_t kCacheVersion = 2;
+
+std::mutex cache_dir_mutex;
+std::string cache_dir;  // empty while disabled
+// the plugin installs the same loader in every runtime
+std::atomic<JSModuleLoaderFunc*> plugin_loader{nullptr};
+std::atomic<int64_t> cache_hits{0};
+std::atomic<int64_t> cache_compiled{0};
+std::atomic<int64_t> cache_passed{0};
+std::mutex base_folder_mutex;
+std::string base_folder;
+
+uint64_t fnv1a(const std::string& data, uint64_t hash) {
+  for (unsigned char c : data) {
+    hash ^= c;
+    hash *= 1099511628211ull;
+  }
+  return hash;
+}
+
+std::string hex(uint64_t hash) {
+  char result[17];
+  snprintf(result, sizeof(result), "%016llx",
+           static_cast<unsigned long long>(hash));
+  return result;
+}
+
+//! Prefix shared by the cache files of every source of a module.
+std::string modulePrefix(const std::string& module_name) {
+  return hex(fnv1a(module_name, 14695981039346656037ull ^ kCacheVersion)) +
+         "-";
+}
+
+std::string cacheName(const std::string& module_name,
+                      const std::string& source) {
+  return modulePrefix(module_name) +
+         hex(fnv1a(source, 14695981039346656037ull)) + ".qbc";
+}
+
+//! Same lookup as the plugin's loader for plain files, empty if the module
+//! is not a file under the base folder.
+fs::path resolveModule(const char* module_name) {
+  fs::path name(module_name);
+  if (name.is_relative()) {
+    std::lock_guard<std::mutex> lock(base_folder_mutex);
+    if (base_folder.empty())
+      return {};
+    name = fs::path(base_folder) / name;
+  }
+  std::error_code ec;
+  for (const char* extension : {"", ".js", ".mjs", ".cjs"}) {
+    fs::path candidate = name;
+    candidate += extension;
+    if (fs::is_regular_file(candidate, ec))
+      return candidate;
+  }
+  return {};
+}
+
+bool readFile(const fs::path& file, std::string* content) {
+  std::ifstream in(file, std::ios::binary);
+  if (!in)
+    return false;
+  content->assign(std::istreambuf_iterator<char>(in),
+                  std::istreambuf_iterator<char>());
+  return true;
+}
+
+fs::path cacheDir() {
+  std::lock_guard<std::mutex> lock(cache_dir_mutex);
+  return cache_dir;
+}
+
+//! Whether only this process could have written `file`.
+bool isPrivate(const fs::path& file) {
+  struct stat info {};
+  return stat(file.c_str(), &info) == 0 && S_ISREG(info.st_mode) &&
+         info.st_uid == getuid() && (info.st_mode & (S_IWGRP | S_IWOTH)) == 0;
+}
+
+//! What quickjs-libc's loader puts in import.meta.
+bool setImportMeta(JSContext* ctx, JSModuleDef* module, const fs::path& file) {
+  JSValue meta = JS_GetImportMeta(ctx, module);
+  if (JS_IsException(meta))
+    return false;
+  std::error_code ec;
+  fs::path real = fs::canonical(file, ec);
+  std::string url = "file://" + (ec ? file : real).string();
+  JS_DefinePropertyValueStr(ctx, meta, "url", JS_NewString(ctx, url.c_str()),
+                            JS_PROP_C_W_E);
+  JS_DefinePropertyValueStr(ctx, meta, "main", JS_NewBool(ctx, false),
+                            JS_PROP_C_W_E);
+  JS_FreeValue(ctx, meta);
+  return true;
+}
+
+//! The module is already referenced by the context, hand out the pointer
+//! alone as the stock loader does.
+JSModuleDef* release(JSContext* ctx, JSValue value) {
+  auto* module = static_cast<JSModuleDef*>(JS_VALUE_GET_PTR(value));
+  JS_FreeValue(ctx, value);
+  return module;
+}
+
+JSModuleDef* loadCached(JSContext* ctx,
+                        const fs::path& file,
+                        const fs::path& source_file) {
+  std::string bytecode;
+  if (!isPrivate(file) || !readFile(file, &bytecode))
+    return nullptr;
+  JSValue module = JS_ReadObject(
+      ctx, reinterpret_cast<const uint8_t*>(bytecode.data()), bytecode.size(),
+      JS_READ_OBJ_BYTECODE);
+  if (JS_IsException(module)) {
+    // written by another QuickJS version, or damaged
+    JS_FreeValue(ctx, JS_GetException(ctx));
+    return nullptr;
+  }
+  if (JS_VALUE_GET_TAG(module) != JS_TAG_MODULE) {
+    JS_FreeValue(ctx, module);
+    return nullptr;
+  }
+  JSModuleDef* result = release(ctx, module);
+  setImportMeta(ctx, result, source_file);
+  return result;
+}
+
+void store(JSContext* ctx, JSValue module, const fs::path& file) {
+  size_t size = 0;
+  uint8_t* bytecode =
+      JS_WriteObject(ctx, &size, module, JS_WRITE_OBJ_BYTECODE);
+  if (!bytecode)
+    return;
+  std::error_code ec;
+  fs::create_directories(file.parent_path(), ec);
+  fs::permissions(file.parent_path(), fs::perms::owner_all, ec);
+  // write aside and rename, so that a reader never sees half a file
+  fs::path temp = file;
+  temp += ".tmp";
+  int fd = open(temp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+  bool written = fd >= 0 && write(fd, bytecode, size) ==
+                                static_cast<ssize_t>(size);
+  if (fd >= 0)
+    close(fd);
+  js_free(ctx, bytecode);
+  if (!written) {
+    fs::remove(temp, ec);
+    return;
+  }
+  fs::rename(temp, file, ec);
+  if (ec)
+    fs::remove(temp, ec);
+}
+
+//! Removes the files cached for earlier sources of the module.
+void pruneOlder(const fs::path& file, const std::string& prefix) {
+  std::error_code ec;
+  for (fs::directory_iterator it(file.parent_path(), ec), end;
+       !ec && it != end; it.increment(ec)) {
+    const fs::path& path = it->path();
+    std::string name = path.filename().string();
+    if (path != file && name.compare(0, prefix.size(), prefix) == 0) {
+      std::error_code ignored;
+      fs::remove(path, ignored);
+    }
+  }
+}
+
+JSModuleDef* passOn(JSContext* ctx, const char* module_name, void* opaque) {
+  cache_passed.fetch_add(1, std::memory_order_relaxed);
+  return plugin_loader.load()(ctx, module_name, opaque);
+}
+
+JSModuleDef* cachingLoader(JSContext* ctx,
+                           const char* module_name,
+                           void* opaque) {
+  fs::path dir = cacheDir();
+  if (dir.empty())
+    return passOn(ctx, module_name, opaque);
+  fs::path source_file = resolveModule(module_name);
+  std::string source;
+  if (source_file.empty() || !readFile(source_file, &source))
+    return passOn(ctx, module_name, opaque);
+
+  fs::path cache_file = dir / cacheName(module_name, source);
+  if (JSModuleDef* module = loadCached(ctx, cache_file, source_file)) {
+    cache_hits.fetch_add(1, std::memory_order_relaxed);
+    return module;
+  }
+
+  JSValue module =
+      JS_Eval(ctx, source.c_str(), source.size(), module_name,
+              JS_EVAL_TYPE_MODULE | JS_EVAL_FLAG_COMPILE_ONLY);
+  if (JS_IsException(module))
+    return nullptr;  // the exception is reported by the importer
+  cache_compiled.fetch_add(1, std::memory_order_relaxed);
+  store(ctx, module, cache_file);
+  pruneOlder(cache_file, modulePrefix(module_name));
+  JSModuleDef* result = release(ctx, module);
+  setImportMeta(ctx, result, source_file);
+  return result;
+}
+
+}  // namespace
+
+extern "C" void __wrap_setQjsBaseFolder(const char* path) {
+  {
+    std::lock_guard<std::mutex> lock(base_folder_mutex);
+    base_folder = path ? path : "";
+  }
+  __real_setQjsBaseFolder(path);
+}
+
+extern "C" void __wrap_JS_SetModuleLoaderFunc(
+    JSRuntime* rt,
+    JSModuleNormalizeFunc* module_normalize,
+    JSModuleLoaderFunc* module_loader,
+    void* opaque) {
+  if (module_loader && module_loader != cachingLoader) {
+    plugin_loader = module_loader;
+    module_loader = cachingLoader;
+  }
+  __real_JS_SetModuleLoaderFunc(rt, module_normalize, module_loader, opaque);
+}
+
+QjsCacheStats qjsBytecodeCacheStats() {
+  QjsCacheStats stats;
+  stats.hits = cache_hits;
+  stats.compiled = cache_compiled;
+  stats.passed = cache_passed;
+  return stats;
+}
+
+void setQjsBytecodeCacheDir(const std::string& dir) {
+  std::lock_guard<std::mutex> lock(cache_dir_mutex);
+  cache_dir = dir;
+}
+
+int clearQjsBytecodeCache() {
+  fs::path dir = cacheDir();
+  if (dir.empty())
+    return 0;
+  std::error_code ec;
+  auto removed = fs::remove_all(dir, ec);
+  return ec ? 0 : static_cast<int>(removed);
+}
+
+//! Enables the cache in `cache_dir`, which has to be app-private storage
+//! such as Context.getCodeCacheDir(); null disables it.
+extern "C" JNIEXPORT void JNICALL
+Java_com_osfans_trime_core_Rime_setRimeQjsBytecodeCache(JNIEnv* env,
+                                                        jclass /* thiz */,
+                                                        jstring cache_dir) {
+  setQjsBytecodeCacheDir(cache_dir ? *CString(env, cache_dir) : "");
+}
+
+//! Deletes the cached bytecode, returns the number of files removed.
+extern "C" JNIEXPORT jint JNICALL
+Java_com_osfans_trime_core_Rime_clearRimeQjsBytecodeCache(JNIEnv* env,
+                                                          jclass /* thiz */) {
+  return clearQjsBytecodeCache();
+}
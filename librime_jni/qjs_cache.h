@@ -0,0 +1,25 @@
+/*
+ * SPDX-FileCopyrightText: 2015 - 2025 Rime community
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+//! Module loads seen by the bytecode cache of librime-qjs since startup.
+struct QjsCacheStats {
+  int64_t hits = 0;      // served from bytecode, not compiled
+  int64_t compiled = 0;  // compiled from source and stored
+  int64_t passed = 0;    // left to the plugin's loader
+};
+
+QjsCacheStats qjsBytecodeCacheStats();
+
+//! Keeps compiled modules in `dir`, empty to disable the cache (the
+//! default). Bytecode is loaded without validation, so `dir` must be
+//! writable by this app alone.
+void setQjsBytecodeCacheDir(const std::string& dir);
+
+//! Deletes the cached bytecode, returns the number of files removed.
+int clearQjsBytecodeCache();
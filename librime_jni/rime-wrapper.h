@@ -0,0 +1,564 @@
+/*
+ * SPDX-FileCopyrightText: 2015 - 2025 Rime community
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+#pragma once
+
+#include <rime_api.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <map>
+#include <memory_resource>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "arena.h"
+#include "candidate_columns.h"
+#include "deploy.h"
+#include "grammar.h"
+#include "helper-types.h"
+#include "key_result.h"
+#include "lua_profiler.h"
+#include "memory.h"
+#include "page_filter.h"
+#include "proto.h"
+#include "qjs_cache.h"
+#include "shared_snapshot.h"
+#include "snapshot.h"
+#include "userdb.h"
+
+#define MAX_BUFFER_LENGTH 2048
+
+//! Session-level wrapper around the rime api, shared by the JNI entry
+//! points and the replay tool. Free of JNI on purpose.
+class Rime {
+ public:
+  Rime() : rime(rime_get_api()) {
+    proto = (RimeProtoApi*)rime->find_module("proto")->get_api();
+  }
+  Rime(Rime const&) = delete;
+  void operator=(Rime const&) = delete;
+
+  static Rime& Instance() {
+    static Rime instance;
+    return instance;
+  }
+
+  //! `context` is handed back to the notification handler.
+  void startup(bool fullCheck,
+               RimeNotificationHandler notificationHandler,
+               void* context) {
+    if (!rime)
+      return;
+    const char* userDir = getenv("RIME_USER_DATA_DIR");
+    const char* sharedDir = getenv("RIME_SHARED_DATA_DIR");
+    const char* versionName = getenv("RIME_DISTRIBUTION_VERSION");
+
+    RIME_STRUCT(RimeTraits, trime_traits)
+    trime_traits.shared_data_dir = sharedDir;
+    trime_traits.user_data_dir = userDir;
+    trime_traits.log_dir = "";  // set empty log_dir to log to logcat only
+    trime_traits.app_name = "rime.trime";
+    trime_traits.distribution_name = "Trime";
+    trime_traits.distribution_code_name = "trime";
+    trime_traits.distribution_version = versionName;
+
+    if (firstRun) {
+      rime->setup(&trime_traits);
+      firstRun = false;
+    }
+    rime->initialize(&trime_traits);
+    installUserDbComponent();
+    installGrammarComponent();
+    installLuaProfiler();
+    installPageFilterComponent();
+    notificationHandler_ = notificationHandler;
+    notificationContext_ = context;
+    rime->set_notification_handler(notificationHandler, context);
+    if (fullCheck) {
+      // modules deleted since are never pruned by the cache itself
+      clearQjsBytecodeCache();
+      if (deployThreads_ >= 0)
+        compileInParallel();
+    }
+    if (rime->start_maintenance(fullCheck)) {
+      rime->join_maintenance_thread();
+    }
+
+    // session ids start over, a status cached before may match the new one
+    invalidateStatus();
+    session_ = rime->create_session();
+    warmUp();
+  }
+
+  bool processKey(int keycode, int mask) {
+    beginLuaKeystroke();
+    bool handled = rime->process_key(session(), keycode, mask);
+    sampleInterpreterHeaps();
+    return published(handled);
+  }
+
+  //! processKey() reporting what the key changed, see KeyResultFlag.
+  int processKeyWithResult(int keycode, int mask) {
+    RimeSessionId sessionId = session();
+    keyResult_.begin(sessionId);
+    beginLuaKeystroke();
+    bool handled = rime->process_key(sessionId, keycode, mask);
+    sampleInterpreterHeaps();
+    // also when only a commit is reported and the context is not fetched
+    return published(keyResult_.end(handled));
+  }
+
+  bool simulateKeySequence(const std::string& sequence) {
+    beginLuaKeystroke();
+    bool handled = rime->simulate_key_sequence(session(), sequence.data());
+    sampleInterpreterHeaps();
+    return published(handled);
+  }
+
+  bool commitComposition() {
+    return published(rime->commit_composition(session()));
+  }
+
+  void clearComposition() {
+    rime->clear_composition(session());
+    publishShared();
+  }
+
+  void commitProto(RIME_PROTO_BUILDER* builder) {
+    proto->commit_proto(session(), builder);
+  }
+
+  void contextProto(RIME_PROTO_BUILDER* builder) {
+    proto->context_proto(session(), builder);
+  }
+
+  void statusProto(RIME_PROTO_BUILDER* builder) {
+    proto->status_proto(session(), builder);
+  }
+
+  //! The JNI-free half of contextProto().
+  bool contextSnapshot(ContextSnapshot* snapshot) {
+    return snapshot->build(session());
+  }
+
+  //! Drops the pending commit text, for callers without a commit builder.
+  void discardCommit() {
+    RIME_STRUCT(RimeCommit, commit)
+    if (rime->get_commit(session(), &commit))
+      rime->free_commit(&commit);
+  }
+
+  void setOption(std::string_view key, bool value) {
+    rime->set_option(session(), key.data(), value);
+    publishShared();
+  }
+
+  bool getOption(std::string_view key) {
+    return rime->get_option(session(), key.data());
+  }
+
+  //! Registers the options reported by optionBits(), at most 64.
+  void setOptionMask(std::vector<std::string> names) {
+    if (names.size() > 64)
+      names.resize(64);
+    maskedOptions_ = std::move(names);
+    optionBitsValid_ = false;
+  }
+
+  //! States of the registered options, bit i for option i. Recomputed only
+  //! after a schema or option notification.
+  uint64_t optionBits() {
+    RimeSessionId sessionId = session();
+    if (!optionBitsValid_ || optionBitsSession_ != sessionId) {
+      optionBits_ = 0;
+      for (size_t i = 0; i < maskedOptions_.size(); ++i) {
+        if (rime->get_option(sessionId, maskedOptions_[i].c_str()))
+          optionBits_ |= uint64_t{1} << i;
+      }
+      optionBitsSession_ = sessionId;
+      optionBitsValid_ = true;
+    }
+    return optionBits_;
+  }
+
+  //! Called on schema and option notifications.
+  void invalidateStatus() {
+    optionBitsValid_ = false;
+    proto->invalidate_status();
+  }
+
+  std::string currentSchemaId() {
+    char result[MAX_BUFFER_LENGTH];
+    return rime->get_current_schema(session(), result, MAX_BUFFER_LENGTH)
+               ? result
+               : "";
+  }
+
+  std::vector<SchemaItem> schemaList() {
+    std::vector<SchemaItem> result;
+    RimeSchemaList list{};
+    if (rime->get_schema_list(&list)) {
+      result = SchemaItem::fromCList(list);
+      rime->free_schema_list(&list);
+    }
+    return std::move(result);
+  }
+
+  bool selectSchema(std::string_view schemaId) {
+    auto warm = warmSessions_.find(schemaId);
+    if (warm == warmSessions_.end()) {
+      if (activeWarmSession_) {
+        RimeSessionId previous = activeWarmSession_;
+        rime->clear_composition(previous);
+        activeWarmSession_ = 0;
+        carryOptions(previous, session(), std::string(schemaId));
+      }
+      return published(rime->select_schema(session(), schemaId.data()));
+    }
+    RimeSessionId previous = session();
+    RimeSessionId target = warm->second;
+    if (!rime->find_session(target) || schemaOf(target) != schemaId) {
+      // expired, or switched away from within the session
+      target = warm->second = createShadowSession(warm->first);
+      if (!target)
+        return false;
+    }
+    if (target != previous) {
+      rime->clear_composition(previous);
+      activeWarmSession_ = target;
+      // a cold switch keeps the context and with it the options
+      carryOptions(previous, target, warm->first);
+      notifySchema(target);
+      publishShared();
+    }
+    return true;
+  }
+
+  //! Keeps an engine constructed for each of these schemas in a shadow
+  //! session, so that selecting one of them swaps the active session
+  //! instead of rebuilding the engine. Costs one engine's memory each.
+  void setWarmSchemas(std::vector<std::string> schemaIds) {
+    warmSchemaIds_ = std::move(schemaIds);
+    warmUp();
+  }
+
+  std::string rawInput() { return rime->get_input(session()); }
+
+  size_t caretPosition() { return rime->get_caret_pos(session()); }
+
+  void setCaretPosition(size_t caretPos) {
+    rime->set_caret_pos(session(), caretPos);
+    publishShared();
+  }
+
+  bool selectCandidateOnCurrentPage(size_t index) {
+    beginLuaKeystroke();
+    return published(rime->select_candidate_on_current_page(session(), index));
+  }
+
+  bool deleteCandidateOnCurrentPage(size_t index) {
+    return published(rime->delete_candidate_on_current_page(session(), index));
+  }
+
+  bool selectCandidate(size_t index) {
+    beginLuaKeystroke();
+    return published(rime->select_candidate(session(), index));
+  }
+
+  bool forgetCandidate(size_t index) {
+    return published(rime->delete_candidate(session(), index));
+  }
+
+  bool changePage(bool backward) {
+    beginLuaKeystroke();
+    return published(rime->change_page(session(), backward));
+  }
+
+  //! Allocated from the active SnapshotArena.
+  std::pmr::vector<CandidateItem> getCandidates(int startIndex, int limit) {
+    // pulling more candidates runs the lua filters again
+    beginLuaKeystroke();
+    std::pmr::vector<CandidateItem> result(SnapshotArena::resource());
+    // the limit comes from the caller, the list is rarely that long
+    result.reserve(std::clamp(limit, 0, 256));
+    RimeCandidateListIterator iter{};
+    if (rime->candidate_list_from_index(session(), &iter, startIndex)) {
+      int count = 0;
+      while (rime->candidate_list_next(&iter)) {
+        if (count >= limit)
+          break;
+        result.emplace_back(iter.candidate);
+        ++count;
+      }
+      rime->candidate_list_end(&iter);
+    }
+    return std::move(result);
+  }
+
+  //! The JNI-free half of getRimeCandidateColumns().
+  bool candidateColumns(int startIndex,
+                        int limit,
+                        uint32_t fields,
+                        CandidateColumns* columns) {
+    beginLuaKeystroke();
+    return columns->build(session(), startIndex, limit, fields);
+  }
+
+  void exit() {
+    keyResult_.reset();
+    for (const auto& warm : warmSessions_) {
+      rime->destroy_session(warm.second);
+    }
+    warmSessions_.clear();
+    activeWarmSession_ = 0;
+    carryPlans_.clear();
+    rime->destroy_session(session_);
+    session_ = 0;
+    rime->finalize();
+    invalidateStatus();
+  }
+
+  bool sync() { return rime->sync_user_data(); }
+
+  //! Lets a full check compile dictionaries on `threads` workers before the
+  //! maintenance thread starts, 0 to size the pool by the cores, -1 to
+  //! leave everything to the maintenance thread (the default).
+  void setDeployThreads(int threads) { deployThreads_ = threads; }
+
+  //! Whether a message from this session should reach the frontend; shadow
+  //! sessions stay silent unless they are the active one.
+  bool shouldNotify(RimeSessionId sessionId) const {
+    if (sessionId == 0)
+      return true;
+    if (creatingShadowSession_)
+      return false;
+    if (activeWarmSession_)
+      return sessionId == activeWarmSession_;
+    for (const auto& warm : warmSessions_) {
+      if (warm.second == sessionId)
+        return false;
+    }
+    return true;
+  }
+
+ private:
+  RimeApi* rime;
+  RimeProtoApi* proto;
+  RimeSessionId session_ = 0;
+  RimeNotificationHandler notificationHandler_ = nullptr;
+  void* notificationContext_ = nullptr;
+  KeyResultTracker keyResult_;
+  int deployThreads_ = -1;
+
+  std::vector<std::string> maskedOptions_;
+  uint64_t optionBits_ = 0;
+  RimeSessionId optionBitsSession_ = 0;
+  bool optionBitsValid_ = false;
+
+  std::vector<std::string> warmSchemaIds_;
+  std::map<std::string, RimeSessionId, std::less<>> warmSessions_;
+  RimeSessionId activeWarmSession_ = 0;
+  //! What selecting a schema does to one of its switches: -1 carries the
+  //! option over, 0 or 1 resets it to that value.
+  struct OptionCarry {
+    std::string name;
+    int value;
+  };
+  // read once per warm schema, so that a switch opens no config
+  std::map<std::string, std::vector<OptionCarry>, std::less<>> carryPlans_;
+  bool creatingShadowSession_ = false;
+
+  RimeSessionId session() {
+    if (activeWarmSession_) {
+      if (rime->find_session(activeWarmSession_))
+        return activeWarmSession_;
+      // expired, fall back to the primary session
+      activeWarmSession_ = 0;
+    }
+    if (session_ == 0 || !rime->find_session(session_)) {
+      session_ = rime->create_session();
+    }
+    return session_;
+  }
+
+  std::string schemaOf(RimeSessionId sessionId) {
+    char result[MAX_BUFFER_LENGTH];
+    return rime->get_current_schema(sessionId, result, MAX_BUFFER_LENGTH)
+               ? result
+               : "";
+  }
+
+  RimeSessionId createShadowSession(const std::string& schemaId) {
+    creatingShadowSession_ = true;
+    RimeSessionId sessionId = rime->create_session();
+    if (sessionId && !rime->select_schema(sessionId, schemaId.c_str())) {
+      rime->destroy_session(sessionId);
+      sessionId = 0;
+    }
+    creatingShadowSession_ = false;
+    return sessionId;
+  }
+
+  void warmUp() {
+    if (!session_)
+      return;
+    carryPlans_.clear();
+    if (!warmSchemaIds_.empty()) {
+      std::vector<std::string> saved = savedOptions();
+      for (const auto& schemaId : warmSchemaIds_)
+        carryPlans_[schemaId] = loadCarryPlan(schemaId, saved);
+    }
+    std::map<std::string, RimeSessionId, std::less<>> sessions;
+    for (const auto& schemaId : warmSchemaIds_) {
+      auto found = warmSessions_.find(schemaId);
+      if (found != warmSessions_.end() && rime->find_session(found->second)) {
+        sessions.insert(warmSessions_.extract(found));
+      } else if (RimeSessionId sessionId = createShadowSession(schemaId)) {
+        sessions.emplace(schemaId, sessionId);
+      }
+    }
+    for (const auto& dropped : warmSessions_) {
+      if (dropped.second == activeWarmSession_) {
+        // the active session survives as the primary one
+        rime->destroy_session(session_);
+        session_ = activeWarmSession_;
+        activeWarmSession_ = 0;
+      } else {
+        rime->destroy_session(dropped.second);
+      }
+    }
+    warmSessions_ = std::move(sessions);
+  }
+
+  //! Gives `to` the options `from` had, as if `schemaId` had been selected
+  //! in `from`: switches with a `reset` value are reset unless they are in
+  //! switcher/save_options. Every change is notified as an option message.
+  void carryOptions(RimeSessionId from,
+                    RimeSessionId to,
+                    const std::string& schemaId) {
+    auto apply = [&](const std::string& name, bool value) {
+      if (rime->get_option(to, name.c_str()) != value)
+        rime->set_option(to, name.c_str(), value);
+    };
+    apply("ascii_mode", rime->get_option(from, "ascii_mode"));
+    std::vector<OptionCarry> loaded;
+    const std::vector<OptionCarry>* plan = &loaded;
+    auto found = carryPlans_.find(schemaId);
+    if (found != carryPlans_.end())
+      plan = &found->second;
+    else
+      loaded = loadCarryPlan(schemaId, savedOptions());
+    for (const auto& option : *plan) {
+      apply(option.name, option.value < 0
+                             ? rime->get_option(from, option.name.c_str())
+                             : option.value != 0);
+    }
+  }
+
+  std::vector<std::string> savedOptions() {
+    std::vector<std::string> saved;
+    RimeConfig config = {nullptr};
+    if (rime->config_open("default", &config)) {
+      size_t count = rime->config_list_size(&config, "switcher/save_options");
+      for (size_t i = 0; i < count; ++i) {
+        std::string key = "switcher/save_options/@" + std::to_string(i);
+        if (const char* name = rime->config_get_cstring(&config, key.c_str()))
+          saved.emplace_back(name);
+      }
+      rime->config_close(&config);
+    }
+    return saved;
+  }
+
+  //! Reads the switches of `schemaId` into what carryOptions() does with
+  //! each of them, ascii_mode aside.
+  std::vector<OptionCarry> loadCarryPlan(
+      const std::string& schemaId,
+      const std::vector<std::string>& saved) {
+    std::vector<OptionCarry> plan;
+    auto isSaved = [&saved](const std::string& name) {
+      return std::find(saved.begin(), saved.end(), name) != saved.end();
+    };
+    RimeConfig config = {nullptr};
+    if (!rime->schema_open(schemaId.c_str(), &config))
+      return plan;
+    size_t count = rime->config_list_size(&config, "switches");
+    for (size_t i = 0; i < count; ++i) {
+      std::string prefix = "switches/@" + std::to_string(i) + "/";
+      int reset = -1;
+      bool hasReset =
+          rime->config_get_int(&config, (prefix + "reset").c_str(), &reset);
+      if (const char* name =
+              rime->config_get_cstring(&config, (prefix + "name").c_str())) {
+        if (std::string(name) == "ascii_mode")
+          continue;
+        bool resets = hasReset && !isSaved(name);
+        plan.push_back({name, resets ? int(reset != 0) : -1});
+        continue;
+      }
+      // a radio group, `reset` being the index of the selected option
+      std::string options = prefix + "options";
+      size_t size = rime->config_list_size(&config, options.c_str());
+      for (size_t j = 0; j < size; ++j) {
+        std::string key = options + "/@" + std::to_string(j);
+        const char* name = rime->config_get_cstring(&config, key.c_str());
+        if (!name)
+          continue;
+        bool resets = hasReset && !isSaved(name);
+        plan.push_back(
+            {name, resets ? int(static_cast<size_t>(reset) == j) : -1});
+      }
+    }
+    rime->config_close(&config);
+    return plan;
+  }
+
+  //! Writes the context into the shared region, if one is enabled, after
+  //! every call that can change it: a candidate window in another process
+  //! must not wait for the frontend to ask for the context.
+  void publishShared() {
+    if (!sharedSnapshotEnabled())
+      return;
+    SnapshotArena::Scope scope;
+    ContextSnapshot snapshot(SnapshotArena::resource());
+    if (snapshot.build(session()))
+      publishSharedSnapshot(snapshot);
+  }
+
+  template <typename T>
+  T published(T result) {
+    publishShared();
+    return result;
+  }
+
+  void compileInParallel() {
+    rime->deploy_config_file("default.yaml", "config_version");
+    std::vector<std::string> schemaIds;
+    for (const auto& item : schemaList())
+      schemaIds.push_back(item.schemaId);
+    compileDictionariesInParallel(
+        schemaIds, deployThreads_, [this](const std::string& value) {
+          if (notificationHandler_)
+            notificationHandler_(notificationContext_, 0, "deploy_task",
+                                 value.c_str());
+        });
+  }
+
+  void notifySchema(RimeSessionId sessionId) {
+    if (!notificationHandler_)
+      return;
+    RIME_STRUCT(RimeStatus, status)
+    if (rime->get_status(sessionId, &status)) {
+      std::string value = std::string(status.schema_id) + "/" +
+                          (status.schema_name ? status.schema_name : "");
+      notificationHandler_(notificationContext_, sessionId, "schema",
+                           value.c_str());
+      rime->free_status(&status);
+    }
+  }
+
+  bool firstRun = true;
+};
@@ -4,14 +4,10 @@
 
 #include <rime_api.h>
 
-#include <string>
-#include <vector>
-
 #include "jni-utils.h"
 #include "objconv.h"
-#include "proto.h"
-
-#define MAX_BUFFER_LENGTH 2048
+#include "predict.h"
+#include "rime-wrapper.h"
 
 extern void rime_require_module_lua();
 extern void rime_require_module_octagram();
@@ -27,171 +23,6 @@ static void declare_librime_module_dependencies() {
   rime_require_module_qjs();
 }
 
-class Rime {
- public:
-  Rime() : rime(rime_get_api()) {
-    proto = (RimeProtoApi*)rime->find_module("proto")->get_api();
-  }
-  Rime(Rime const&) = delete;
-  void operator=(Rime const&) = delete;
-
-  static Rime& Instance() {
-    static Rime instance;
-    return instance;
-  }
-
-  void startup(bool fullCheck,
-               const RimeNotificationHandler& notificationHandler) {
-    if (!rime)
-      return;
-    const char* userDir = getenv("RIME_USER_DATA_DIR");
-    const char* sharedDir = getenv("RIME_SHARED_DATA_DIR");
-    const char* versionName = getenv("RIME_DISTRIBUTION_VERSION");
-
-    RIME_STRUCT(RimeTraits, trime_traits)
-    trime_traits.shared_data_dir = sharedDir;
-    trime_traits.user_data_dir = userDir;
-    trime_traits.log_dir = "";  // set empty log_dir to log to logcat only
-    trime_traits.app_name = "rime.trime";
-    trime_traits.distribution_name = "Trime";
-    trime_traits.distribution_code_name = "trime";
-    trime_traits.distribution_version = versionName;
-
-    if (firstRun) {
-      rime->setup(&trime_traits);
-      firstRun = false;
-    }
-    rime->initialize(&trime_traits);
-    rime->set_notification_handler(notificationHandler, GlobalRef->jvm);
-    if (rime->start_maintenance(fullCheck)) {
-      rime->join_maintenance_thread();
-    }
-
-    session_ = rime->create_session();
-  }
-
-  bool processKey(int keycode, int mask) {
-    return rime->process_key(session(), keycode, mask);
-  }
-
-  bool simulateKeySequence(const std::string& sequence) {
-    return rime->simulate_key_sequence(session(), sequence.data());
-  }
-
-  bool commitComposition() { return rime->commit_composition(session()); }
-
-  void clearComposition() { rime->clear_composition(session()); }
-
-  void commitProto(RIME_PROTO_BUILDER* builder) {
-    proto->commit_proto(session(), builder);
-  }
-
-  void contextProto(RIME_PROTO_BUILDER* builder) {
-    proto->context_proto(session(), builder);
-  }
-
-  void statusProto(RIME_PROTO_BUILDER* builder) {
-    proto->status_proto(session(), builder);
-  }
-
-  void setOption(std::string_view key, bool value) {
-    rime->set_option(session(), key.data(), value);
-  }
-
-  bool getOption(std::string_view key) {
-    return rime->get_option(session(), key.data());
-  }
-
-  std::string currentSchemaId() {
-    char result[MAX_BUFFER_LENGTH];
-    return rime->get_current_schema(session(), result, MAX_BUFFER_LENGTH)
-               ? result
-               : "";
-  }
-
-  std::vector<SchemaItem> schemaList() {
-    std::vector<SchemaItem> result;
-    RimeSchemaList list{};
-    if (rime->get_schema_list(&list)) {
-      result = SchemaItem::fromCList(list);
-      rime->free_schema_list(&list);
-    }
-    return std::move(result);
-  }
-
-  bool selectSchema(std::string_view schemaId) {
-    return rime->select_schema(session(), schemaId.data());
-  }
-
-  std::string rawInput() { return rime->get_input(session()); }
-
-  size_t caretPosition() { return rime->get_caret_pos(session()); }
-
-  void setCaretPosition(size_t caretPos) {
-    rime->set_caret_pos(session(), caretPos);
-  }
-
-  bool selectCandidateOnCurrentPage(size_t index) {
-    return rime->select_candidate_on_current_page(session(), index);
-  }
-
-  bool deleteCandidateOnCurrentPage(size_t index) {
-    return rime->delete_candidate_on_current_page(session(), index);
-  }
-
-  bool selectCandidate(size_t index) {
-    return rime->select_candidate(session(), index);
-  }
-
-  bool forgetCandidate(size_t index) {
-    return rime->delete_candidate(session(), index);
-  }
-
-  bool changePage(bool backward) {
-    return rime->change_page(session(), backward);
-  }
-
-  std::vector<CandidateItem> getCandidates(int startIndex, int limit) {
-    std::vector<CandidateItem> result;
-    result.reserve(limit);
-    RimeCandidateListIterator iter{};
-    if (rime->candidate_list_from_index(session(), &iter, startIndex)) {
-      int count = 0;
-      while (rime->candidate_list_next(&iter)) {
-        if (count >= limit)
-          break;
-        const CandidateItem item(iter.candidate);
-        result.emplace_back(item);
-        ++count;
-      }
-      rime->candidate_list_end(&iter);
-    }
-    return std::move(result);
-  }
-
-  void exit() {
-    rime->destroy_session(session_);
-    session_ = 0;
-    rime->finalize();
-  }
-
-  bool sync() { return rime->sync_user_data(); }
-
- private:
-  RimeApi* rime;
-  RimeProtoApi* proto;
-  RimeSessionId session_ = 0;
-
-  RimeSessionId session() {
-    if (session_ == 0 || !rime->find_session(session_)) {
-      session_ = rime->create_session();
-    }
-    return session_;
-  }
-
-  bool firstRun = true;
-};
-
 GlobalRefSingleton* GlobalRef;
 
 JNIEXPORT jint JNICALL JNI_OnLoad(JavaVM* jvm, void* reserved) {
@@ -216,27 +47,36 @@ Java_com_osfans_trime_core_Rime_startupRime(JNIEnv* env,
   auto notificationHandler = [](void* context_object, RimeSessionId session_id,
                                 const char* message_type,
                                 const char* message_value) {
-    auto env = GlobalRef->AttachEnv();
-    int type = 0;  // unknown
+    RimeMessageType type = kUnknownMessage;
     if (strcmp(message_type, "schema") == 0) {
-      type = 1;
+      type = kSchemaMessage;
+      Rime::Instance().invalidateStatus();
     } else if (strcmp(message_type, "option") == 0) {
-      type = 2;
+      type = kOptionMessage;
+      Rime::Instance().invalidateStatus();
     } else if (strcmp(message_type, "deploy") == 0) {
-      type = 3;
+      type = kDeployMessage;
+      resetPredictions();
+    } else if (strcmp(message_type, "deploy_task") == 0) {
+      type = kDeployTaskMessage;
     }
+    if (!Rime::Instance().shouldNotify(session_id))
+      return;
+    auto env = GlobalRef->AttachEnv();
     auto vararg = JRef<jobjectArray>(
         env, env->NewObjectArray(1, GlobalRef->Object, nullptr));
     env->SetObjectArrayElement(vararg, 0, JString(env, message_value));
-    env->CallStaticVoidMethod(GlobalRef->Rime, GlobalRef->HandleRimeMessage,
-                              type, *vararg);
+    postRimeMessage(env, type, vararg);
   };
 
-  Rime::Instance().startup(full_check, notificationHandler);
+  Rime::Instance().startup(full_check, notificationHandler, GlobalRef->jvm);
 }
 
 extern "C" JNIEXPORT void JNICALL
 Java_com_osfans_trime_core_Rime_exitRime(JNIEnv* env, jclass /* thiz */) {
+  stopPredictions();
+  stopUserDbTransfer();
+  stopUserDbCompaction();
   Rime::Instance().exit();
 }
 
@@ -257,6 +97,15 @@ Java_com_osfans_trime_core_Rime_deployRimeConfigFile(JNIEnv* env,
                                             CString(env, version_key));
 }
 
+//! Worker threads for the dictionaries of a full deployment, see
+//! Rime::setDeployThreads(). Applies from the next startupRime().
+extern "C" JNIEXPORT void JNICALL
+Java_com_osfans_trime_core_Rime_setRimeDeployThreads(JNIEnv* env,
+                                                     jclass /* thiz */,
+                                                     jint threads) {
+  Rime::Instance().setDeployThreads(threads);
+}
+
 extern "C" JNIEXPORT jboolean JNICALL
 Java_com_osfans_trime_core_Rime_syncRimeUserData(JNIEnv* env,
                                                  jclass /* thiz */) {
@@ -272,6 +121,17 @@ Java_com_osfans_trime_core_Rime_processRimeKey(JNIEnv* env,
   return Rime::Instance().processKey(keycode, mask);
 }
 
+//! Like processRimeKey(), but returns KeyResultFlag bits telling whether
+//! getRimeContext() is needed; a key that commits and leaves no composition
+//! reports kCompositionCleared instead of kCompositionChanged.
+extern "C" JNIEXPORT jint JNICALL
+Java_com_osfans_trime_core_Rime_processRimeKeyWithResult(JNIEnv* env,
+                                                         jclass /* thiz */,
+                                                         jint keycode,
+                                                         jint mask) {
+  return Rime::Instance().processKeyWithResult(keycode, mask);
+}
+
 extern "C" JNIEXPORT jboolean JNICALL
 Java_com_osfans_trime_core_Rime_commitRimeComposition(JNIEnv* env,
                                                       jclass /* thiz */) {
@@ -322,6 +182,19 @@ Java_com_osfans_trime_core_Rime_getRimeOption(JNIEnv* env,
   return Rime::Instance().getOption(*CString(env, option));
 }
 
+extern "C" JNIEXPORT void JNICALL
+Java_com_osfans_trime_core_Rime_setRimeOptionMask(JNIEnv* env,
+                                                  jclass /* thiz */,
+                                                  jobjectArray options) {
+  Rime::Instance().setOptionMask(stringArrayToStringVector(env, options));
+}
+
+extern "C" JNIEXPORT jlong JNICALL
+Java_com_osfans_trime_core_Rime_getRimeOptionBits(JNIEnv* env,
+                                                  jclass /* thiz */) {
+  return static_cast<jlong>(Rime::Instance().optionBits());
+}
+
 extern "C" JNIEXPORT jobjectArray JNICALL
 Java_com_osfans_trime_core_Rime_getRimeSchemaList(JNIEnv* env,
                                                   jclass /* thiz */) {
@@ -341,6 +214,13 @@ Java_com_osfans_trime_core_Rime_selectRimeSchema(JNIEnv* env,
   return Rime::Instance().selectSchema(*CString(env, schema_id));
 }
 
+extern "C" JNIEXPORT void JNICALL
+Java_com_osfans_trime_core_Rime_setRimeWarmSchemas(JNIEnv* env,
+                                                   jclass /* thiz */,
+                                                   jobjectArray schema_ids) {
+  Rime::Instance().setWarmSchemas(stringArrayToStringVector(env, schema_ids));
+}
+
 // testing
 extern "C" JNIEXPORT jboolean JNICALL
 Java_com_osfans_trime_core_Rime_simulateRimeKeySequence(JNIEnv* env,
@@ -410,6 +290,22 @@ Java_com_osfans_trime_core_Rime_getRimeCandidates(JNIEnv* env,
                                                   jclass clazz,
                                                   jint start_index,
                                                   jint limit) {
+  SnapshotArena::Scope scope;
   return rimeCandidateListToJObjectArray(
       env, Rime::Instance().getCandidates(start_index, limit));
 }
+
+//! Only the fields in `fields` (CandidateField bits) of up to `limit`
+//! candidates from `start_index`, see candidateColumnsToJObjectArray().
+extern "C" JNIEXPORT jobjectArray JNICALL
+Java_com_osfans_trime_core_Rime_getRimeCandidateColumns(JNIEnv* env,
+                                                        jclass clazz,
+                                                        jint start_index,
+                                                        jint limit,
+                                                        jint fields) {
+  SnapshotArena::Scope scope;
+  CandidateColumns columns(SnapshotArena::resource());
+  Rime::Instance().candidateColumns(start_index, limit,
+                                    static_cast<uint32_t>(fields), &columns);
+  return candidateColumnsToJObjectArray(env, columns);
+}
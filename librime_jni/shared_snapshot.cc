@@ -0,0 +1,273 @@
+// SPDX-FileCopyrightText: 2015 - 2024 Rime community
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+// Context snapshots published into shared memory, so that a candidate
+// window in another process reads them without calling into the engine.
+// The region is a memfd, or ashmem on kernels without memfd. Its fd goes
+// to the other process over binder; once the writable mapping exists the
+// region is sealed against further writable mappings. A region that cannot
+// be sealed is never handed out.
+
+#include "shared_snapshot.h"
+
+#include <fcntl.h>
+#include <linux/memfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#ifdef __ANDROID__
+#include <linux/ashmem.h>
+#include <sys/ioctl.h>
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <mutex>
+#include <string_view>
+
+#include "jni-utils.h"
+#include "snapshot.h"
+
+#ifndef F_SEAL_FUTURE_WRITE
+#define F_SEAL_FUTURE_WRITE 0x0010  // linux 5.1
+#endif
+
+// the same layout for 32 and 64 bit readers
+static_assert(sizeof(RimeSharedSnapshot) == 104);
+static_assert(sizeof(RimeSharedCandidate) == 24);
+
+namespace {
+
+constexpr size_t kDefaultCapacity = 64 * 1024;
+constexpr size_t kMaxCapacity = 4 * 1024 * 1024;
+constexpr char kRegionName[] = "rime-context";
+
+std::mutex region_mutex;
+std::atomic<bool> publishing{false};
+int region_fd = -1;
+char* region = nullptr;
+size_t region_size = 0;
+
+int createMemfd(size_t size) {
+#ifdef __NR_memfd_create
+  int fd = static_cast<int>(syscall(__NR_memfd_create, kRegionName,
+                                    MFD_CLOEXEC | MFD_ALLOW_SEALING));
+  if (fd < 0)
+    return -1;
+  if (ftruncate(fd, static_cast<off_t>(size)) != 0) {
+    close(fd);
+    return -1;
+  }
+  if (fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW) != 0) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+#else
+  return -1;
+#endif
+}
+
+int createAshmem(size_t size) {
+#ifdef __ANDROID__
+  int fd = open("/dev/ashmem", O_RDWR | O_CLOEXEC);
+  if (fd < 0)
+    return -1;
+  char name[ASHMEM_NAME_LEN] = {};
+  strncpy(name, kRegionName, sizeof(name) - 1);
+  ioctl(fd, ASHMEM_SET_NAME, name);
+  if (ioctl(fd, ASHMEM_SET_SIZE, size) < 0) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+#else
+  return -1;
+#endif
+}
+
+//! Readers only get read-only mappings from here on; ours stays writable.
+bool sealWrites(int fd, bool memfd) {
+  if (memfd)  // needs linux 5.1
+    return fcntl(fd, F_ADD_SEALS, F_SEAL_FUTURE_WRITE) == 0;
+#ifdef __ANDROID__
+  return ioctl(fd, ASHMEM_SET_PROT_MASK, PROT_READ) == 0;
+#else
+  return false;
+#endif
+}
+
+//! Maps `fd` writable and seals it, or closes it and returns nullptr.
+char* mapSealed(int fd, size_t size, bool memfd) {
+  void* mapped =
+      mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (mapped != MAP_FAILED && sealWrites(fd, memfd))
+    return static_cast<char*>(mapped);
+  if (mapped != MAP_FAILED)
+    munmap(mapped, size);
+  close(fd);
+  return nullptr;
+}
+
+//! Copies strings into the strings area, as long as they fit.
+class StringWriter {
+ public:
+  StringWriter(char* base, size_t capacity)
+      : base_(base), capacity_(capacity) {}
+
+  bool put(std::string_view value, RimeSharedString* result) {
+    if (value.size() > capacity_ - size_) {
+      *result = {};
+      return false;
+    }
+    memcpy(base_ + size_, value.data(), value.size());
+    *result = {static_cast<uint32_t>(size_),
+               static_cast<uint32_t>(value.size())};
+    size_ += value.size();
+    return true;
+  }
+
+  size_t size() const { return size_; }
+
+ private:
+  char* base_;
+  size_t capacity_;
+  size_t size_ = 0;
+};
+
+}  // namespace
+
+int enableSharedSnapshot(size_t capacity) {
+  std::lock_guard<std::mutex> lock(region_mutex);
+  if (region) {
+    publishing = true;
+    return region_fd;
+  }
+  size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+  size_t size = std::clamp(capacity ? capacity : kDefaultCapacity,
+                           sizeof(RimeSharedSnapshot), kMaxCapacity);
+  size = (size + page - 1) / page * page;
+  char* mapped = nullptr;
+  int fd = createMemfd(size);
+  if (fd >= 0 && !(mapped = mapSealed(fd, size, true)))
+    fd = -1;
+  if (fd < 0) {
+    // older kernels cannot seal a memfd against new writable mappings
+    fd = createAshmem(size);
+    if (fd >= 0 && !(mapped = mapSealed(fd, size, false)))
+      fd = -1;
+  }
+  if (fd < 0)
+    return -1;
+  region = mapped;
+  region_fd = fd;
+  region_size = size;
+  auto* header = reinterpret_cast<RimeSharedSnapshot*>(region);
+  memset(header, 0, sizeof(*header));
+  header->magic = RIME_SHARED_SNAPSHOT_MAGIC;
+  header->version = RIME_SHARED_SNAPSHOT_VERSION;
+  header->region_size = static_cast<uint32_t>(size);
+  header->candidates_offset = sizeof(RimeSharedSnapshot);
+  header->strings_offset = sizeof(RimeSharedSnapshot);
+  publishing = true;
+  return fd;
+}
+
+void disableSharedSnapshot() {
+  std::lock_guard<std::mutex> lock(region_mutex);
+  publishing = false;
+  if (!region)
+    return;
+  munmap(region, region_size);
+  close(region_fd);
+  region = nullptr;
+  region_fd = -1;
+  region_size = 0;
+}
+
+bool sharedSnapshotEnabled() {
+  return publishing.load(std::memory_order_relaxed);
+}
+
+void publishSharedSnapshot(const ContextSnapshot& snapshot) {
+  if (!publishing.load(std::memory_order_relaxed))
+    return;
+  std::lock_guard<std::mutex> lock(region_mutex);
+  if (!region)
+    return;
+  auto* header = reinterpret_cast<RimeSharedSnapshot*>(region);
+  uint32_t sequence = header->sequence;
+  __atomic_store_n(&header->sequence, sequence + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+
+  uint32_t flags = 0;
+  if (snapshot.composing)
+    flags |= kRimeSharedComposing;
+  if (snapshot.has_menu)
+    flags |= kRimeSharedHasMenu;
+  if (snapshot.is_last_page)
+    flags |= kRimeSharedLastPage;
+  header->generation++;
+  header->caret_pos = static_cast<int32_t>(snapshot.caret_pos);
+  header->sel_start = static_cast<int32_t>(snapshot.sel_start);
+  header->sel_end = static_cast<int32_t>(snapshot.sel_end);
+  header->input_caret_pos = static_cast<int32_t>(snapshot.input_caret_pos);
+  header->page_size = snapshot.page_size;
+  header->page_number = snapshot.page_number;
+  header->highlighted_index = snapshot.highlighted_index;
+
+  // candidates right after the header, strings after the candidates
+  size_t room = region_size - sizeof(RimeSharedSnapshot);
+  size_t count = std::min(snapshot.candidates.size(),
+                          room / sizeof(RimeSharedCandidate));
+  auto* candidates = reinterpret_cast<RimeSharedCandidate*>(
+      region + sizeof(RimeSharedSnapshot));
+  size_t strings_offset =
+      sizeof(RimeSharedSnapshot) + count * sizeof(RimeSharedCandidate);
+  StringWriter strings(region + strings_offset, region_size - strings_offset);
+  bool complete = count == snapshot.candidates.size();
+  complete &= strings.put(snapshot.input, &header->input);
+  complete &= strings.put(snapshot.preedit, &header->preedit);
+  complete &= strings.put(snapshot.commit_text_preview,
+                          &header->commit_text_preview);
+  complete &= strings.put(snapshot.select_keys, &header->select_keys);
+  size_t written = 0;
+  for (; written < count; ++written) {
+    const auto& src = snapshot.candidates[written];
+    RimeSharedCandidate& dest = candidates[written];
+    if (!strings.put(src.text, &dest.text) ||
+        !strings.put(src.comment, &dest.comment) ||
+        !strings.put(src.label, &dest.label)) {
+      complete = false;
+      break;
+    }
+  }
+  if (!complete)
+    flags |= kRimeSharedTruncated;
+  header->flags = flags;
+  header->candidate_count = static_cast<uint32_t>(written);
+  header->candidates_offset = sizeof(RimeSharedSnapshot);
+  header->strings_offset = static_cast<uint32_t>(strings_offset);
+  header->strings_size = static_cast<uint32_t>(strings.size());
+
+  __atomic_store_n(&header->sequence, sequence + 2, __ATOMIC_RELEASE);
+}
+
+//! Starts publishing the context after every key or other change into a
+//! shared region of `capacity` bytes (0 for 64 KiB). Returns the region's fd for
+//! ParcelFileDescriptor.fromFd(), which dups it, or -1 on failure.
+extern "C" JNIEXPORT jint JNICALL
+Java_com_osfans_trime_core_Rime_enableRimeSharedSnapshot(JNIEnv* env,
+                                                         jclass /* thiz */,
+                                                         jint capacity) {
+  return enableSharedSnapshot(capacity > 0 ? static_cast<size_t>(capacity)
+                                           : 0);
+}
+
+extern "C" JNIEXPORT void JNICALL
+Java_com_osfans_trime_core_Rime_disableRimeSharedSnapshot(JNIEnv* env,
+                                                          jclass /* thiz */) {
+  disableSharedSnapshot();
+}
@@ -0,0 +1,100 @@
+/*
+ * SPDX-FileCopyrightText: 2015 - 2025 Rime community
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+#pragma once
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Layout of the shared context snapshot, for readers in other processes.
+ *
+ * The region starts with a RimeSharedSnapshot, followed by
+ * `candidate_count` RimeSharedCandidate at `candidates_offset` and the
+ * UTF-8 strings area at `strings_offset`. Strings are not NUL terminated;
+ * their offsets are relative to the strings area. All offsets are in bytes
+ * from the start of the region.
+ *
+ * The writer follows a seqlock: `sequence` is odd while a snapshot is being
+ * written. A reader loads `sequence` (acquire), retries while it is odd,
+ * copies what it needs, issues an acquire fence and loads `sequence`
+ * again; the copy is consistent only if both loads are equal.
+ */
+
+#define RIME_SHARED_SNAPSHOT_MAGIC 0x504e5352u /* "RSNP" */
+#define RIME_SHARED_SNAPSHOT_VERSION 1
+
+enum {
+  kRimeSharedComposing = 1 << 0,
+  kRimeSharedHasMenu = 1 << 1,
+  kRimeSharedLastPage = 1 << 2,
+  //! Candidates or strings were dropped for lack of room.
+  kRimeSharedTruncated = 1 << 3,
+};
+
+typedef struct rime_shared_string_t {
+  uint32_t offset;
+  uint32_t length;
+} RimeSharedString;
+
+typedef struct rime_shared_candidate_t {
+  RimeSharedString text;
+  RimeSharedString comment;
+  RimeSharedString label;
+} RimeSharedCandidate;
+
+typedef struct rime_shared_snapshot_t {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t region_size;
+  uint32_t sequence;
+  //! Bumped with every snapshot, lets readers skip unchanged ones.
+  uint64_t generation;
+
+  uint32_t flags;
+  int32_t caret_pos;
+  int32_t sel_start;
+  int32_t sel_end;
+  int32_t input_caret_pos;
+  int32_t page_size;
+  int32_t page_number;
+  int32_t highlighted_index;
+
+  RimeSharedString input;
+  RimeSharedString preedit;
+  RimeSharedString commit_text_preview;
+  RimeSharedString select_keys;
+
+  uint32_t candidate_count;
+  uint32_t candidates_offset;
+  uint32_t strings_offset;
+  uint32_t strings_size;
+} RimeSharedSnapshot;
+
+#ifdef __cplusplus
+}
+
+#include <cstddef>
+
+class ContextSnapshot;
+
+//! Creates the shared region of `capacity` bytes (0 for the default) and
+//! starts publishing into it. Returns its file descriptor, still owned by
+//! the library, or -1 on failure. Enabling again returns the same region.
+int enableSharedSnapshot(size_t capacity);
+
+//! Stops publishing and releases the region; mappings of readers stay
+//! valid but no longer change.
+void disableSharedSnapshot();
+
+//! Whether a region is being published into.
+bool sharedSnapshotEnabled();
+
+//! Writes `snapshot` into the region if publishing is enabled. Called by
+//! the Rime wrapper after every call that can change the context.
+void publishSharedSnapshot(const ContextSnapshot& snapshot);
+#endif
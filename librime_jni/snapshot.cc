@@ -0,0 +1,94 @@
+// SPDX-FileCopyrightText: 2015 - 2024 Rime community
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include "snapshot.h"
+
+#include <rime/composition.h>
+#include <rime/context.h>
+#include <rime/menu.h>
+#include <rime/schema.h>
+#include <rime/service.h>
+
+#include <charconv>
+
+#include "arena.h"
+
+using namespace rime;
+
+ContextSnapshot::ContextSnapshot(std::pmr::memory_resource* resource)
+    : select_labels(resource), candidates(resource) {}
+
+ContextSnapshot::~ContextSnapshot() = default;
+
+bool ContextSnapshot::build(RimeSessionId session_id) {
+  session_ = Service::instance().GetSession(session_id);
+  if (!session_)
+    return false;
+  Context* ctx = session_->context();
+  if (!ctx)
+    return false;
+  input = ctx->input();
+  input_caret_pos = ctx->caret_pos();
+  composing = ctx->IsComposing();
+  if (composing) {
+    const Preedit& preedit_info = ctx->GetPreedit();
+    preedit = SnapshotArena::copy(preedit_info.text);
+    caret_pos = preedit_info.caret_pos;
+    sel_start = preedit_info.sel_start;
+    sel_end = preedit_info.sel_end;
+    commit_text_preview = SnapshotArena::copy(ctx->GetCommitText());
+  }
+  if (!ctx->HasMenu())
+    return true;
+  Segment& seg = ctx->composition().back();
+  Schema* schema = session_->schema();
+  page_size = schema ? schema->page_size() : 5;
+  int selected_index = seg.selected_index;
+  page_number = selected_index / page_size;
+  highlighted_index = selected_index % page_size;
+  if (schema)
+    select_keys = schema->select_keys();
+  page_.reset(seg.menu->CreatePage(page_size, page_number));
+  if (!page_)
+    return true;
+  has_menu = true;
+  is_last_page = page_->is_last_page;
+
+  std::pmr::vector<std::string_view> labels(SnapshotArena::resource());
+  labels.reserve(page_size);
+  if (schema) {
+    Config* config = schema->config();
+    auto src_labels = config->GetList("menu/alternative_select_labels");
+    if (src_labels && (size_t)page_size <= src_labels->size()) {
+      select_labels.resize(page_size);
+      for (int i = 0; i < page_size; ++i) {
+        if (an<ConfigValue> value = src_labels->GetValueAt(i)) {
+          select_labels[i] = SnapshotArena::copy(value->str());
+          labels.push_back(select_labels[i]);
+        }
+      }
+    } else if (!select_keys.empty()) {
+      for (const char& key : select_keys) {
+        labels.emplace_back(&key, 1);
+        if (labels.size() >= page_size)
+          break;
+      }
+    }
+  }
+  candidates.reserve(page_->candidates.size());
+  char number[16];
+  for (const an<Candidate>& src : page_->candidates) {
+    size_t index = candidates.size();
+    std::string_view label;
+    if (index < labels.size()) {
+      label = labels[index];
+    } else {
+      auto end = std::to_chars(number, number + sizeof(number), index + 1);
+      label = SnapshotArena::copy(std::string_view(number, end.ptr - number));
+    }
+    candidates.push_back(
+        {src->text(), SnapshotArena::copy(src->comment()), label});
+  }
+  return true;
+}
@@ -0,0 +1,61 @@
+/*
+ * SPDX-FileCopyrightText: 2015 - 2025 Rime community
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+#pragma once
+
+#include <rime/common.h>
+#include <rime_api.h>
+
+#include <memory_resource>
+#include <string_view>
+#include <vector>
+
+namespace rime {
+class Session;
+struct Page;
+}  // namespace rime
+
+//! What rime_context_proto reads from a session, gathered without any JNI
+//! call so that the replay tool measures the same path. Strings point into
+//! the session and its current page, or into the active SnapshotArena; they
+//! stay valid until the session processes another key.
+class ContextSnapshot {
+ public:
+  struct Candidate {
+    std::string_view text;
+    std::string_view comment;
+    std::string_view label;
+  };
+
+  explicit ContextSnapshot(std::pmr::memory_resource* resource);
+  ~ContextSnapshot();
+
+  //! Returns false if the session or its context is gone.
+  bool build(RimeSessionId session_id);
+
+  bool composing = false;
+  std::string_view preedit;
+  size_t caret_pos = 0;
+  size_t sel_start = 0;
+  size_t sel_end = 0;
+  std::string_view commit_text_preview;
+
+  bool has_menu = false;
+  int page_size = 0;
+  int page_number = 0;
+  bool is_last_page = false;
+  int highlighted_index = 0;
+  std::string_view select_keys;
+  //! menu/alternative_select_labels, one per slot, empty where the config
+  //! has no value. Left empty when the schema does not define them.
+  std::pmr::vector<std::string_view> select_labels;
+  std::pmr::vector<Candidate> candidates;
+
+  std::string_view input;
+  size_t input_caret_pos = 0;
+
+ private:
+  rime::an<rime::Session> session_;
+  rime::the<rime::Page> page_;
+};
@@ -0,0 +1,407 @@
+// SPDX-FileCopyrightText: 2015 - 2024 Rime community
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+// Replays a keystroke corpus through the same Rime wrapper paths as the
+// JNI layer (processRimeKey, then the context snapshot behind
+// getRimeContext) and reports per-key latency, allocations and RSS.
+//
+//   rime_replay --shared-dir DIR --user-dir DIR [--schema ID]
+//               [--repeat N] [--warmup N] [--save FILE]
+//               [--baseline FILE] [--tolerance RATIO] [--qjs-cache DIR]
+//               CORPUS
+//
+// The corpus holds one key sequence per line in librime's simulate syntax
+// ("nihao{space}", "{Shift+Return}"), blank lines and lines starting with
+// '#' are skipped. The composition is cleared after each line.
+//
+// With --baseline, the run fails (exit code 2) when a gated metric exceeds
+// the baseline by more than the tolerance (default 0.1, i.e. 10%).
+//
+// --qjs-cache enables the QuickJS bytecode cache in DIR; a second run over
+// the same DIR reports the modules as qjs_cache_hits and compiles none.
+
+#include <rime/key_event.h>
+#include <sys/resource.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <new>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "../memory.h"
+#include "../qjs_cache.h"
+#include "../rime-wrapper.h"
+
+// Every C++ allocation of the process goes through these, librime's
+// included. Plain malloc (Lua, QuickJS, leveldb's C parts) is not seen.
+namespace {
+std::atomic<uint64_t> allocation_count{0};
+std::atomic<uint64_t> allocation_bytes{0};
+
+void* countedAllocate(size_t size) {
+  allocation_count.fetch_add(1, std::memory_order_relaxed);
+  allocation_bytes.fetch_add(size, std::memory_order_relaxed);
+  return std::malloc(size ? size : 1);
+}
+
+void* countedAllocate(size_t size, std::align_val_t alignment) {
+  allocation_count.fetch_add(1, std::memory_order_relaxed);
+  allocation_bytes.fetch_add(size, std::memory_order_relaxed);
+  size_t align = static_cast<size_t>(alignment);
+  return std::aligned_alloc(align, (size + align - 1) / align * align);
+}
+}  // namespace
+
+void* operator new(size_t size) {
+  if (void* p = countedAllocate(size))
+    return p;
+  throw std::bad_alloc();
+}
+
+void* operator new[](size_t size) {
+  return operator new(size);
+}
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept {
+  return countedAllocate(size);
+}
+
+void* operator new[](size_t size, const std::nothrow_t&) noexcept {
+  return countedAllocate(size);
+}
+
+void* operator new(size_t size, std::align_val_t alignment) {
+  if (void* p = countedAllocate(size, alignment))
+    return p;
+  throw std::bad_alloc();
+}
+
+void* operator new[](size_t size, std::align_val_t alignment) {
+  return operator new(size, alignment);
+}
+
+void operator delete(void* p) noexcept {
+  std::free(p);
+}
+
+void operator delete[](void* p) noexcept {
+  std::free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+  std::free(p);
+}
+
+void operator delete[](void* p, size_t) noexcept {
+  std::free(p);
+}
+
+void operator delete(void* p, std::align_val_t) noexcept {
+  std::free(p);
+}
+
+void operator delete[](void* p, std::align_val_t) noexcept {
+  std::free(p);
+}
+
+void operator delete(void* p, size_t, std::align_val_t) noexcept {
+  std::free(p);
+}
+
+void operator delete[](void* p, size_t, std::align_val_t) noexcept {
+  std::free(p);
+}
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+//! Metrics compared against a baseline, lower is better for all of them.
+const char* const kGatedMetrics[] = {
+    "total_p50_us",   "total_p90_us",   "total_p99_us",
+    "allocs_per_key", "bytes_per_key",  "rss_end_kb",
+};
+
+struct Options {
+  std::string shared_dir;
+  std::string user_dir;
+  std::string schema;
+  std::string corpus;
+  std::string save;
+  std::string baseline;
+  std::string qjs_cache;
+  int repeat = 1;
+  int warmup = 1;
+  double tolerance = 0.1;
+};
+
+struct Samples {
+  std::vector<double> process_us;
+  std::vector<double> snapshot_us;
+  std::vector<double> total_us;
+  uint64_t allocations = 0;
+  uint64_t allocated_bytes = 0;
+  size_t unhandled = 0;
+};
+
+void usage() {
+  std::cerr << "usage: rime_replay --shared-dir DIR --user-dir DIR "
+               "[--schema ID] [--repeat N] [--warmup N] [--save FILE] "
+               "[--baseline FILE] [--tolerance RATIO] [--qjs-cache DIR] "
+               "CORPUS\n";
+}
+
+bool parseOptions(int argc, char* argv[], Options* options) {
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    auto value = [&]() -> const char* {
+      return i + 1 < argc ? argv[++i] : nullptr;
+    };
+    const char* v = nullptr;
+    if (arg == "--shared-dir" && (v = value())) {
+      options->shared_dir = v;
+    } else if (arg == "--user-dir" && (v = value())) {
+      options->user_dir = v;
+    } else if (arg == "--schema" && (v = value())) {
+      options->schema = v;
+    } else if (arg == "--repeat" && (v = value())) {
+      options->repeat = std::max(1, std::atoi(v));
+    } else if (arg == "--warmup" && (v = value())) {
+      options->warmup = std::max(0, std::atoi(v));
+    } else if (arg == "--save" && (v = value())) {
+      options->save = v;
+    } else if (arg == "--baseline" && (v = value())) {
+      options->baseline = v;
+    } else if (arg == "--tolerance" && (v = value())) {
+      options->tolerance = std::atof(v);
+    } else if (arg == "--qjs-cache" && (v = value())) {
+      options->qjs_cache = v;
+    } else if (!arg.empty() && arg[0] != '-' && options->corpus.empty()) {
+      options->corpus = arg;
+    } else {
+      return false;
+    }
+  }
+  return !options->shared_dir.empty() && !options->user_dir.empty() &&
+         !options->corpus.empty();
+}
+
+bool loadCorpus(const std::string& file, std::vector<rime::KeySequence>* out) {
+  std::ifstream in(file);
+  if (!in)
+    return false;
+  std::string line;
+  int line_number = 0;
+  while (std::getline(in, line)) {
+    ++line_number;
+    if (line.empty() || line[0] == '#')
+      continue;
+    rime::KeySequence keys;
+    if (!keys.Parse(line)) {
+      std::cerr << file << ":" << line_number << ": bad key sequence\n";
+      return false;
+    }
+    out->push_back(std::move(keys));
+  }
+  return true;
+}
+
+double microseconds(Clock::duration duration) {
+  return std::chrono::duration<double, std::micro>(duration).count();
+}
+
+void replay(Rime& rime,
+            const std::vector<rime::KeySequence>& corpus,
+            Samples* samples) {
+  for (const auto& keys : corpus) {
+    for (const auto& key : keys) {
+      uint64_t count = allocation_count.load(std::memory_order_relaxed);
+      uint64_t bytes = allocation_bytes.load(std::memory_order_relaxed);
+      auto start = Clock::now();
+      if (!rime.processKey(key.keycode(), key.modifier()))
+        ++samples->unhandled;
+      auto processed = Clock::now();
+      {
+        SnapshotArena::Scope scope;
+        ContextSnapshot snapshot(SnapshotArena::resource());
+        rime.contextSnapshot(&snapshot);
+      }
+      rime.discardCommit();
+      auto end = Clock::now();
+      samples->process_us.push_back(microseconds(processed - start));
+      samples->snapshot_us.push_back(microseconds(end - processed));
+      samples->total_us.push_back(microseconds(end - start));
+      samples->allocations +=
+          allocation_count.load(std::memory_order_relaxed) - count;
+      samples->allocated_bytes +=
+          allocation_bytes.load(std::memory_order_relaxed) - bytes;
+    }
+    rime.clearComposition();
+  }
+}
+
+double percentile(std::vector<double> values, double rank) {
+  if (values.empty())
+    return 0;
+  size_t index = static_cast<size_t>(rank * (values.size() - 1) + 0.5);
+  std::nth_element(values.begin(), values.begin() + index, values.end());
+  return values[index];
+}
+
+double mean(const std::vector<double>& values) {
+  if (values.empty())
+    return 0;
+  double sum = 0;
+  for (double value : values)
+    sum += value;
+  return sum / values.size();
+}
+
+int64_t residentSetKb() {
+  int64_t usage[kMemoryUsageFieldCount];
+  collectMemoryUsage(usage);
+  return usage[kResidentSet] / 1024;
+}
+
+int64_t peakResidentSetKb() {
+  struct rusage usage {};
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_maxrss;
+}
+
+using Report = std::vector<std::pair<std::string, double>>;
+
+void addDistribution(Report* report,
+                     const char* name,
+                     const std::vector<double>& values) {
+  std::string prefix(name);
+  report->emplace_back(prefix + "_mean_us", mean(values));
+  report->emplace_back(prefix + "_p50_us", percentile(values, 0.5));
+  report->emplace_back(prefix + "_p90_us", percentile(values, 0.9));
+  report->emplace_back(prefix + "_p99_us", percentile(values, 0.99));
+  report->emplace_back(prefix + "_max_us", percentile(values, 1.0));
+}
+
+void writeReport(std::ostream& out, const Report& report) {
+  for (const auto& metric : report) {
+    out << metric.first << " " << metric.second << "\n";
+  }
+}
+
+std::map<std::string, double> readReport(const std::string& file) {
+  std::map<std::string, double> result;
+  std::ifstream in(file);
+  std::string name;
+  double value;
+  while (in >> name >> value) {
+    result[name] = value;
+  }
+  return result;
+}
+
+int compareWithBaseline(const Report& report,
+                        const std::string& file,
+                        double tolerance) {
+  auto baseline = readReport(file);
+  if (baseline.empty()) {
+    std::cerr << "cannot read baseline " << file << "\n";
+    return 1;
+  }
+  int regressions = 0;
+  for (const char* name : kGatedMetrics) {
+    auto expected = baseline.find(name);
+    auto actual = std::find_if(report.begin(), report.end(),
+                               [&](const auto& m) { return m.first == name; });
+    if (expected == baseline.end() || actual == report.end())
+      continue;
+    double limit = expected->second * (1 + tolerance);
+    bool regressed = actual->second > limit && actual->second > 0;
+    std::cerr << (regressed ? "REGRESSION " : "ok ") << name << " "
+              << actual->second << " (baseline " << expected->second << ")\n";
+    if (regressed)
+      ++regressions;
+  }
+  return regressions ? 2 : 0;
+}
+
+void onMessage(void* /* context */,
+               RimeSessionId /* session_id */,
+               const char* message_type,
+               const char* message_value) {
+  std::cerr << "[" << message_type << "] " << message_value << "\n";
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  Options options;
+  if (!parseOptions(argc, argv, &options)) {
+    usage();
+    return 1;
+  }
+  std::vector<rime::KeySequence> corpus;
+  if (!loadCorpus(options.corpus, &corpus))
+    return 1;
+
+  setenv("RIME_SHARED_DATA_DIR", options.shared_dir.c_str(), 1);
+  setenv("RIME_USER_DATA_DIR", options.user_dir.c_str(), 1);
+  setenv("RIME_DISTRIBUTION_VERSION", "replay", 1);
+  setQjsBytecodeCacheDir(options.qjs_cache);
+  Rime& rime = Rime::Instance();
+  rime.startup(false, &onMessage, nullptr);
+  if (!options.schema.empty() && !rime.selectSchema(options.schema)) {
+    std::cerr << "cannot select schema " << options.schema << "\n";
+    rime.exit();
+    return 1;
+  }
+
+  int64_t rss_start = residentSetKb();
+  Samples warmup;
+  for (int i = 0; i < options.warmup; ++i) {
+    replay(rime, corpus, &warmup);
+  }
+  Samples samples;
+  for (int i = 0; i < options.repeat; ++i) {
+    replay(rime, corpus, &samples);
+  }
+  int64_t rss_end = residentSetKb();
+
+  size_t keys = samples.total_us.size();
+  Report report;
+  report.emplace_back("keys", keys);
+  report.emplace_back("unhandled_keys", samples.unhandled);
+  addDistribution(&report, "process", samples.process_us);
+  addDistribution(&report, "snapshot", samples.snapshot_us);
+  addDistribution(&report, "total", samples.total_us);
+  report.emplace_back("allocs_per_key",
+                      keys ? double(samples.allocations) / keys : 0);
+  report.emplace_back("bytes_per_key",
+                      keys ? double(samples.allocated_bytes) / keys : 0);
+  report.emplace_back("rss_start_kb", rss_start);
+  report.emplace_back("rss_end_kb", rss_end);
+  report.emplace_back("rss_peak_kb", peakResidentSetKb());
+  QjsCacheStats qjs = qjsBytecodeCacheStats();
+  report.emplace_back("qjs_cache_hits", qjs.hits);
+  report.emplace_back("qjs_cache_compiled", qjs.compiled);
+
+  rime.exit();
+
+  writeReport(std::cout, report);
+  if (!options.save.empty()) {
+    std::ofstream out(options.save);
+    writeReport(out, report);
+  }
+  if (!options.baseline.empty())
+    return compareWithBaseline(report, options.baseline, options.tolerance);
+  return 0;
+}
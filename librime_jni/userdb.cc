@@ -0,0 +1,855 @@
+// SPDX-FileCopyrightText: 2015 - 2024 Rime community
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include "userdb.h"
+
+#include <leveldb/cache.h>
+#include <leveldb/db.h>
+#include <leveldb/filter_policy.h>
+#include <leveldb/write_batch.h>
+#include <rime/algo/dynamics.h>
+#include <rime/deployer.h>
+#include <rime/dict/db.h>
+#include <rime/dict/user_db.h>
+#include <rime/registry.h>
+#include <rime/service.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "jni-utils.h"
+
+using namespace rime;
+
+namespace {
+
+const char* kMetaCharacter = "\x01";
+
+//! An open leveldb together with the tuning objects it was opened with.
+//! Shared with background compaction, which may outlive the Db until
+//! stopUserDbCompaction().
+struct LevelDbHandle {
+  string path;
+  std::shared_ptr<leveldb::Cache> block_cache;
+  std::shared_ptr<const leveldb::FilterPolicy> filter_policy;
+  std::unique_ptr<leveldb::DB> db;
+};
+
+std::mutex options_mutex;
+UserDbOptions current_options;
+std::shared_ptr<leveldb::Cache> shared_block_cache;
+std::shared_ptr<const leveldb::FilterPolicy> shared_filter_policy;
+
+std::mutex handles_mutex;
+std::vector<std::weak_ptr<LevelDbHandle>> open_handles;
+
+std::mutex compaction_mutex;
+std::thread compaction_thread;
+std::atomic<bool> compaction_running{false};
+std::atomic<bool> compaction_cancelled{false};
+
+leveldb::Options MakeOptions(LevelDbHandle* handle) {
+  std::lock_guard<std::mutex> lock(options_mutex);
+  leveldb::Options options;
+  if (current_options.write_buffer_size)
+    options.write_buffer_size = current_options.write_buffer_size;
+  options.compression = current_options.compression
+                            ? leveldb::kSnappyCompression
+                            : leveldb::kNoCompression;
+  handle->block_cache = shared_block_cache;
+  options.block_cache = shared_block_cache.get();
+  handle->filter_policy = shared_filter_policy;
+  options.filter_policy = shared_filter_policy.get();
+  return options;
+}
+
+std::vector<std::shared_ptr<LevelDbHandle>> OpenHandles() {
+  std::vector<std::shared_ptr<LevelDbHandle>> result;
+  std::lock_guard<std::mutex> lock(handles_mutex);
+  auto it = open_handles.begin();
+  while (it != open_handles.end()) {
+    if (auto handle = it->lock()) {
+      result.push_back(std::move(handle));
+      ++it;
+    } else {
+      it = open_handles.erase(it);
+    }
+  }
+  return result;
+}
+
+//! The open handle of `file_path`, or a newly opened one. leveldb admits a
+//! single opener per process, so engines and bulk transfers of the same
+//! db share one handle.
+std::shared_ptr<LevelDbHandle> AcquireHandle(const string& file_path,
+                                             bool create_if_missing,
+                                             string* error) {
+  std::lock_guard<std::mutex> lock(handles_mutex);
+  for (const auto& weak : open_handles) {
+    auto handle = weak.lock();
+    if (handle && handle->path == file_path)
+      return handle;
+  }
+  auto handle = std::make_shared<LevelDbHandle>();
+  leveldb::Options options = MakeOptions(handle.get());
+  options.create_if_missing = create_if_missing;
+  leveldb::DB* db = nullptr;
+  auto status = leveldb::DB::Open(options, file_path, &db);
+  if (!status.ok()) {
+    if (error)
+      *error = status.ToString();
+    return nullptr;
+  }
+  handle->db.reset(db);
+  handle->path = file_path;
+  open_handles.push_back(handle);
+  return handle;
+}
+
+//! Whether an engine or a transfer still holds `file_path` open.
+bool HandleInUse(const string& file_path) {
+  std::lock_guard<std::mutex> lock(handles_mutex);
+  for (const auto& weak : open_handles) {
+    auto handle = weak.lock();
+    if (handle && handle->path == file_path)
+      return true;
+  }
+  return false;
+}
+
+class TunableLevelDbAccessor : public DbAccessor {
+ public:
+  TunableLevelDbAccessor(std::shared_ptr<LevelDbHandle> handle,
+                         const string& prefix)
+      : DbAccessor(prefix),
+        handle_(std::move(handle)),
+        is_metadata_query_(prefix == kMetaCharacter) {
+    leveldb::ReadOptions options;
+    options.fill_cache = false;
+    iterator_.reset(handle_->db->NewIterator(options));
+    Reset();
+  }
+
+  bool Reset() override { return Jump(prefix_); }
+
+  bool Jump(const string& key) override {
+    iterator_->Seek(key);
+    return true;
+  }
+
+  bool GetNextRecord(string* key, string* value) override {
+    if (!iterator_->Valid() || !key || !value)
+      return false;
+    *key = iterator_->key().ToString();
+    if (!MatchesPrefix(*key))
+      return false;
+    if (is_metadata_query_)
+      key->erase(0, 1);
+    *value = iterator_->value().ToString();
+    iterator_->Next();
+    return true;
+  }
+
+  bool exhausted() override {
+    return !iterator_->Valid() ||
+           !MatchesPrefix(iterator_->key().ToString());
+  }
+
+ private:
+  std::shared_ptr<LevelDbHandle> handle_;
+  // declared after handle_ to be destroyed before the db it iterates
+  std::unique_ptr<leveldb::Iterator> iterator_;
+  bool is_metadata_query_;
+};
+
+//! Same storage layout as librime's LevelDb, opened with UserDbOptions.
+class TunableUserDb : public Db, public Recoverable, public Transactional {
+ public:
+  TunableUserDb(const path& file_path, const string& db_name)
+      : Db(file_path, db_name) {}
+
+  ~TunableUserDb() override {
+    if (loaded())
+      Close();
+  }
+
+  bool Remove() override {
+    if (loaded()) {
+      LOG(ERROR) << "attempt to remove opened db '" << name() << "'.";
+      return false;
+    }
+    if (HandleInUse(file_path().string())) {
+      LOG(ERROR) << "db '" << name() << "' is in use, not removing.";
+      return false;
+    }
+    auto status =
+        leveldb::DestroyDB(file_path().string(), leveldb::Options());
+    if (!status.ok()) {
+      LOG(ERROR) << "Error removing db '" << name()
+                 << "': " << status.ToString();
+      return false;
+    }
+    return true;
+  }
+
+  bool Open() override {
+    if (loaded())
+      return false;
+    readonly_ = false;
+    loaded_ = OpenHandle();
+    if (loaded_) {
+      string db_name;
+      if (!MetaFetch("/db_name", &db_name) && !CreateMetadata()) {
+        LOG(ERROR) << "error creating metadata.";
+        Close();
+      }
+    }
+    return loaded_;
+  }
+
+  bool OpenReadOnly() override {
+    if (loaded())
+      return false;
+    readonly_ = true;
+    loaded_ = OpenHandle();
+    return loaded_;
+  }
+
+  bool Close() override {
+    if (!loaded())
+      return false;
+    handle_.reset();
+    batch_.Clear();
+    LOG(INFO) << "closed db '" << name() << "'.";
+    loaded_ = false;
+    readonly_ = false;
+    in_transaction_ = false;
+    return true;
+  }
+
+  bool Backup(const path& snapshot_file) override {
+    if (!loaded())
+      return false;
+    LOG(INFO) << "backing up db '" << name() << "' to " << snapshot_file;
+    return UserDbHelper(this).UniformBackup(snapshot_file);
+  }
+
+  bool Restore(const path& snapshot_file) override {
+    if (!loaded() || readonly())
+      return false;
+    return UserDbHelper(this).UniformRestore(snapshot_file);
+  }
+
+  bool CreateMetadata() override {
+    return Db::CreateMetadata() && MetaUpdate("/db_type", "userdb") &&
+           UserDbHelper(this).UpdateUserInfo();
+  }
+
+  bool MetaFetch(const string& key, string* value) override {
+    return Fetch(kMetaCharacter + key, value);
+  }
+
+  bool MetaUpdate(const string& key, const string& value) override {
+    return Update(kMetaCharacter + key, value);
+  }
+
+  an<DbAccessor> QueryMetadata() override { return Query(kMetaCharacter); }
+
+  an<DbAccessor> QueryAll() override {
+    an<DbAccessor> all = Query("");
+    if (all)
+      all->Jump(" ");  // skip metadata
+    return all;
+  }
+
+  an<DbAccessor> Query(const string& key) override {
+    if (!loaded())
+      return nullptr;
+    return New<TunableLevelDbAccessor>(handle_, key);
+  }
+
+  bool Fetch(const string& key, string* value) override {
+    if (!value || !loaded())
+      return false;
+    return handle_->db->Get(leveldb::ReadOptions(), key, value).ok();
+  }
+
+  bool Update(const string& key, const string& value) override {
+    if (!loaded() || readonly())
+      return false;
+    if (in_transaction()) {
+      batch_.Put(key, value);
+      return true;
+    }
+    return handle_->db->Put(leveldb::WriteOptions(), key, value).ok();
+  }
+
+  bool Erase(const string& key) override {
+    if (!loaded() || readonly())
+      return false;
+    if (in_transaction()) {
+      batch_.Delete(key);
+      return true;
+    }
+    return handle_->db->Delete(leveldb::WriteOptions(), key).ok();
+  }
+
+  // Recoverable
+  bool Recover() override {
+    if (HandleInUse(file_path().string())) {
+      LOG(ERROR) << "db '" << name() << "' is in use, not recovering.";
+      return false;
+    }
+    LOG(INFO) << "trying to recover db '" << name() << "'.";
+    auto status = leveldb::RepairDB(file_path().string(), leveldb::Options());
+    if (!status.ok()) {
+      LOG(ERROR) << "db recovery failed: " << status.ToString();
+      return false;
+    }
+    return true;
+  }
+
+  // Transactional
+  bool BeginTransaction() override {
+    if (!loaded())
+      return false;
+    batch_.Clear();
+    in_transaction_ = true;
+    return true;
+  }
+
+  bool AbortTransaction() override {
+    if (!loaded() || !in_transaction())
+      return false;
+    batch_.Clear();
+    in_transaction_ = false;
+    return true;
+  }
+
+  bool CommitTransaction() override {
+    if (!loaded() || !in_transaction())
+      return false;
+    bool ok = handle_->db->Write(leveldb::WriteOptions(), &batch_).ok();
+    batch_.Clear();
+    in_transaction_ = false;
+    return ok;
+  }
+
+ private:
+  bool OpenHandle() {
+    string error;
+    handle_ = AcquireHandle(file_path().string(), !readonly_, &error);
+    if (!handle_) {
+      LOG(ERROR) << "Error opening db '" << name() << "': " << error;
+      return false;
+    }
+    return true;
+  }
+
+  std::shared_ptr<LevelDbHandle> handle_;
+  leveldb::WriteBatch batch_;
+};
+
+class TunableUserDbComponent : public UserDb::Component,
+                               protected DbComponentBase {
+ public:
+  Db* Create(const string& name) override {
+    return new TunableUserDb(DbFilePath(name, extension()), name);
+  }
+
+  string extension() const override { return ".userdb"; }
+
+  string snapshot_extension() const override { return ".userdb.txt"; }
+};
+
+
+// bulk import / export
+
+constexpr size_t kBatchEntries = 4096;
+constexpr char kBinaryMagic[] = "RIMEUDB1";
+// what librime's UserDictionary writes for a word committed once
+constexpr char kDefaultValue[] = "c=1 d=1 t=1";
+const string kTickKey = string(kMetaCharacter) + "/tick";
+
+std::mutex transfer_mutex;
+std::thread transfer_thread;
+std::atomic<bool> transfer_running{false};
+std::atomic<bool> transfer_cancelled{false};
+int next_transfer_id = 1;
+
+void postTransfer(int id,
+                  const char* event,
+                  const string& done,
+                  int64_t total) {
+  if (!GlobalRef)
+    return;
+  auto env = GlobalRef->AttachEnv();
+  // this thread never returns to java, local refs have to go explicitly
+  env->PushLocalFrame(8);
+  jobjectArray args = env->NewObjectArray(4, GlobalRef->Object, nullptr);
+  env->SetObjectArrayElement(args, 0, JString(env, std::to_string(id)));
+  env->SetObjectArrayElement(args, 1, JString(env, event));
+  env->SetObjectArrayElement(args, 2, JString(env, done));
+  env->SetObjectArrayElement(args, 3, JString(env, std::to_string(total)));
+  postRimeMessage(env, kUserDbMessage, args);
+  env->PopLocalFrame(nullptr);
+}
+
+void putVarint(std::ostream& out, uint64_t value) {
+  while (value >= 0x80) {
+    out.put(static_cast<char>(value | 0x80));
+    value >>= 7;
+  }
+  out.put(static_cast<char>(value));
+}
+
+bool getVarint(std::istream& in, uint64_t* value) {
+  *value = 0;
+  for (int shift = 0; shift < 64; shift += 7) {
+    int c = in.get();
+    if (c == EOF)
+      return false;
+    *value |= uint64_t(c & 0x7f) << shift;
+    if (!(c & 0x80))
+      return true;
+  }
+  return false;
+}
+
+bool getRecord(std::istream& in, string* data) {
+  uint64_t size;
+  // a record is never larger than a line of the text format
+  if (!getVarint(in, &size) || size > (1 << 20))
+    return false;
+  data->resize(size);
+  return bool(in.read(&(*data)[0], size));
+}
+
+//! Splits "code\ttext[\tvalue]" into a userdb key and value like
+//! librime's userdb_entry_parser, false for comments and malformed lines.
+bool parseLine(const string& line, string* key, string* value) {
+  if (line.empty() || line[0] == '#')
+    return false;
+  size_t code_end = line.find('\t');
+  if (code_end == string::npos || code_end == 0)
+    return false;
+  size_t text_end = line.find('\t', code_end + 1);
+  string text = line.substr(code_end + 1, text_end == string::npos
+                                              ? string::npos
+                                              : text_end - code_end - 1);
+  if (text.empty())
+    return false;
+  // keys store the code with a trailing space, exports keep it
+  *key = line.substr(0, code_end);
+  if (key->back() != ' ')
+    *key += ' ';
+  *key += '\t' + text;
+  *value = text_end == string::npos ? string(kDefaultValue)
+                                    : line.substr(text_end + 1);
+  return true;
+}
+
+//! Reads a "#@/key\tvalue" metadata line as written by librime's snapshots.
+bool parseMetaLine(const string& line, string* key, string* value) {
+  if (line.compare(0, 2, "#@") != 0)
+    return false;
+  size_t separator = line.find('\t');
+  if (separator == string::npos)
+    return false;
+  *key = line.substr(2, separator - 2);
+  *value = line.substr(separator + 1);
+  return true;
+}
+
+TickCount parseTick(const string& value) {
+  try {
+    return std::stoull(value);
+  } catch (...) {
+    return 0;
+  }
+}
+
+class Transfer {
+ public:
+  Transfer(int id, std::shared_ptr<LevelDbHandle> handle, int64_t total)
+      : id_(id), handle_(std::move(handle)), total_(total) {}
+
+  void Import(std::istream& in, UserDbFormat format, bool replace) {
+    string tick;
+    if (handle_->db->Get(leveldb::ReadOptions(), kTickKey, &tick).ok())
+      our_tick_ = parseTick(tick);
+    max_tick_ = our_tick_;
+    leveldb::WriteBatch batch;
+    size_t batched = 0;
+    string line, key, value;
+    while (!transfer_cancelled) {
+      if (format == UserDbFormat::kBinary) {
+        if (!getRecord(in, &key) || !getRecord(in, &value))
+          break;
+        if (!key.empty() && key[0] == *kMetaCharacter) {
+          MetaPut(key.substr(1), value);
+          continue;
+        }
+      } else {
+        if (!std::getline(in, line))
+          break;
+        if (!line.empty() && line.back() == '\r')
+          line.pop_back();
+        if (parseMetaLine(line, &key, &value)) {
+          MetaPut(key, value);
+          continue;
+        }
+        if (!parseLine(line, &key, &value))
+          continue;
+      }
+      string merged = replace ? value : Merge(key, value);
+      batch.Put(key, merged);
+      pending_[key] = std::move(merged);
+      ++done_;
+      if (++batched == kBatchEntries && !transfer_cancelled) {
+        if (!Flush(&batch))
+          return;
+        batched = 0;
+        Progress(static_cast<int64_t>(in.tellg()));
+      }
+    }
+    if (transfer_cancelled) {
+      // batches already written stay, the tick only comes with all of them
+      Finish();
+      return;
+    }
+    batch.Put(kTickKey, std::to_string(max_tick_));
+    if (!Flush(&batch))
+      return;
+    Finish();
+  }
+
+  void Export(std::ostream& out, UserDbFormat format) {
+    leveldb::ReadOptions options;
+    options.fill_cache = false;
+    options.snapshot = handle_->db->GetSnapshot();
+    std::unique_ptr<leveldb::Iterator> it(handle_->db->NewIterator(options));
+    if (format == UserDbFormat::kBinary) {
+      out << kBinaryMagic;
+    } else {
+      out << "# Rime user dictionary\n";
+    }
+    // metadata sorts first, as in librime's snapshots
+    for (it->SeekToFirst(); it->Valid() && !transfer_cancelled; it->Next()) {
+      leveldb::Slice key = it->key();
+      leveldb::Slice value = it->value();
+      bool meta = !key.empty() && key[0] == *kMetaCharacter;
+      if (format == UserDbFormat::kBinary) {
+        putVarint(out, key.size());
+        out.write(key.data(), key.size());
+        putVarint(out, value.size());
+        out.write(value.data(), value.size());
+      } else if (meta) {
+        out << "#@";
+        out.write(key.data() + 1, key.size() - 1);
+        out << '\t';
+        out.write(value.data(), value.size());
+        out << '\n';
+      } else {
+        // "code \ttext" already holds the first tab
+        out.write(key.data(), key.size());
+        out << '\t';
+        out.write(value.data(), value.size());
+        out << '\n';
+      }
+      if (meta)
+        continue;
+      if (++done_ % kBatchEntries == 0)
+        Progress(-1);
+    }
+    it.reset();
+    handle_->db->ReleaseSnapshot(options.snapshot);
+    if (!out) {
+      postTransfer(id_, "error", "write failed", total_);
+      return;
+    }
+    Finish();
+  }
+
+ private:
+  bool Flush(leveldb::WriteBatch* batch) {
+    auto status = handle_->db->Write(leveldb::WriteOptions(), batch);
+    batch->Clear();
+    pending_.clear();
+    if (!status.ok())
+      postTransfer(id_, "error", status.ToString(), total_);
+    return status.ok();
+  }
+
+  void Progress(int64_t position) {
+    // imports count bytes against the file size, exports count entries
+    postTransfer(id_, "progress",
+                 std::to_string(position >= 0 ? position : done_), total_);
+  }
+
+  void Finish() {
+    postTransfer(id_, transfer_cancelled ? "cancelled" : "done",
+                 std::to_string(done_), total_);
+  }
+
+  void MetaPut(const string& key, const string& value) {
+    if (key == "/tick") {
+      their_tick_ = parseTick(value);
+      max_tick_ = std::max(our_tick_, their_tick_);
+    }
+  }
+
+  //! UserDbMerger::Put: decays both sides to their own tick, then keeps
+  //! the commit count larger in magnitude, with its sign (negative marks a
+  //! deleted entry), and the larger weight.
+  string Merge(const string& key, const string& value) {
+    UserDbValue theirs(value);
+    UserDbValue ours;
+    auto it = pending_.find(key);
+    if (it != pending_.end()) {
+      // not in the db until the batch is written
+      ours.Unpack(it->second);
+    } else {
+      string existing;
+      if (handle_->db->Get(leveldb::ReadOptions(), key, &existing).ok())
+        ours.Unpack(existing);
+    }
+    if (ours.tick < our_tick_) {
+      ours.dee = algo::formula_d(0, static_cast<double>(our_tick_), ours.dee,
+                                 static_cast<double>(ours.tick));
+    }
+    if (theirs.tick < their_tick_) {
+      theirs.dee =
+          algo::formula_d(0, static_cast<double>(their_tick_), theirs.dee,
+                          static_cast<double>(theirs.tick));
+    }
+    if (std::abs(theirs.commits) > std::abs(ours.commits))
+      ours.commits = theirs.commits;
+    ours.dee = std::max(ours.dee, theirs.dee);
+    ours.tick = max_tick_;
+    return ours.Pack();
+  }
+
+  int id_;
+  std::shared_ptr<LevelDbHandle> handle_;
+  int64_t total_;
+  int64_t done_ = 0;
+  TickCount our_tick_ = 0;
+  TickCount their_tick_ = 0;
+  TickCount max_tick_ = 0;
+  // values of the batch not yet written, by key
+  std::unordered_map<string, string> pending_;
+};
+
+template <typename Job>
+int StartTransfer(Job&& job) {
+  std::lock_guard<std::mutex> lock(transfer_mutex);
+  if (transfer_running)
+    return -1;
+  if (transfer_thread.joinable())
+    transfer_thread.join();
+  int id = next_transfer_id++;
+  transfer_running = true;
+  transfer_cancelled = false;
+  transfer_thread = std::thread([id, job = std::forward<Job>(job)]() mutable {
+    job(id);
+    transfer_running = false;
+    if (GlobalRef)
+      GlobalRef->jvm->DetachCurrentThread();
+  });
+  return id;
+}
+
+string UserDbPath(const string& db_name) {
+  const Deployer& deployer = Service::instance().deployer();
+  return (path(deployer.user_data_dir) / (db_name + ".userdb")).string();
+}
+
+}  // namespace
+
+void setUserDbOptions(const UserDbOptions& options) {
+  std::lock_guard<std::mutex> lock(options_mutex);
+  current_options = options;
+  // databases already open keep the cache and filter they were opened with
+  shared_block_cache.reset(
+      options.block_cache_size
+          ? leveldb::NewLRUCache(options.block_cache_size)
+          : nullptr);
+  shared_filter_policy.reset(
+      options.bloom_bits_per_key > 0
+          ? leveldb::NewBloomFilterPolicy(options.bloom_bits_per_key)
+          : nullptr);
+}
+
+void installUserDbComponent() {
+  Registry::instance().Register("userdb", new TunableUserDbComponent);
+}
+
+int compactUserDbs() {
+  std::lock_guard<std::mutex> lock(compaction_mutex);
+  if (compaction_running)
+    return 0;
+  if (compaction_thread.joinable())
+    compaction_thread.join();
+  auto handles = OpenHandles();
+  if (handles.empty())
+    return 0;
+  int count = static_cast<int>(handles.size());
+  compaction_running = true;
+  compaction_cancelled = false;
+  compaction_thread = std::thread([handles = std::move(handles)] {
+    // a single compaction cannot be interrupted, stop between databases
+    for (const auto& handle : handles) {
+      if (compaction_cancelled)
+        break;
+      handle->db->CompactRange(nullptr, nullptr);
+    }
+    compaction_running = false;
+  });
+  return count;
+}
+
+void stopUserDbCompaction() {
+  std::lock_guard<std::mutex> lock(compaction_mutex);
+  compaction_cancelled = true;
+  if (compaction_thread.joinable())
+    compaction_thread.join();
+}
+
+int64_t userDbMemoryUsage() {
+  int64_t total = 0;
+  std::set<leveldb::Cache*> caches;
+  for (const auto& handle : OpenHandles()) {
+    std::string usage;
+    if (handle->db->GetProperty("leveldb.approximate-memory-usage", &usage))
+      total += std::stoll(usage);
+    if (handle->block_cache) {
+      // the property includes the block cache, count shared caches once
+      total -= handle->block_cache->TotalCharge();
+      caches.insert(handle->block_cache.get());
+    }
+  }
+  for (auto* cache : caches) {
+    total += cache->TotalCharge();
+  }
+  return total;
+}
+
+int importUserDb(const std::string& db_name,
+                 const std::string& file,
+                 UserDbFormat format,
+                 bool replace) {
+  string db_path = UserDbPath(db_name);
+  return StartTransfer([=](int id) {
+    std::ifstream in(file, std::ios::binary | std::ios::ate);
+    int64_t total = in ? static_cast<int64_t>(in.tellg()) : -1;
+    in.seekg(0);
+    if (format == UserDbFormat::kBinary) {
+      char magic[sizeof(kBinaryMagic) - 1] = {};
+      in.read(magic, sizeof(magic));
+      if (string(magic, sizeof(magic)) != kBinaryMagic)
+        in.setstate(std::ios::failbit);
+    }
+    if (!in) {
+      postTransfer(id, "error", "cannot read " + file, total);
+      return;
+    }
+    string error;
+    auto handle = AcquireHandle(db_path, true, &error);
+    if (!handle) {
+      postTransfer(id, "error", "cannot open " + db_path + ": " + error,
+                   total);
+      return;
+    }
+    Transfer(id, std::move(handle), total).Import(in, format, replace);
+  });
+}
+
+int exportUserDb(const std::string& db_name,
+                 const std::string& file,
+                 UserDbFormat format) {
+  string db_path = UserDbPath(db_name);
+  return StartTransfer([=](int id) {
+    string error;
+    auto handle = AcquireHandle(db_path, false, &error);
+    if (!handle) {
+      postTransfer(id, "error", "cannot open " + db_path + ": " + error, -1);
+      return;
+    }
+    std::ofstream out(file, std::ios::binary | std::ios::trunc);
+    if (!out) {
+      postTransfer(id, "error", "cannot write " + file, -1);
+      return;
+    }
+    Transfer(id, std::move(handle), -1).Export(out, format);
+  });
+}
+
+void cancelUserDbTransfer() {
+  transfer_cancelled = true;
+}
+
+void stopUserDbTransfer() {
+  std::lock_guard<std::mutex> lock(transfer_mutex);
+  transfer_cancelled = true;
+  if (transfer_thread.joinable())
+    transfer_thread.join();
+}
+
+extern "C" JNIEXPORT void JNICALL
+Java_com_osfans_trime_core_Rime_setRimeUserDbOptions(JNIEnv* env,
+                                                     jclass /* thiz */,
+                                                     jlong block_cache_size,
+                                                     jlong write_buffer_size,
+                                                     jboolean compression,
+                                                     jint bloom_bits_per_key) {
+  UserDbOptions options;
+  options.block_cache_size = static_cast<size_t>(block_cache_size);
+  options.write_buffer_size = static_cast<size_t>(write_buffer_size);
+  options.compression = compression;
+  options.bloom_bits_per_key = bloom_bits_per_key;
+  setUserDbOptions(options);
+}
+
+extern "C" JNIEXPORT jint JNICALL
+Java_com_osfans_trime_core_Rime_compactRimeUserDb(JNIEnv* env,
+                                                  jclass /* thiz */) {
+  return compactUserDbs();
+}
+
+extern "C" JNIEXPORT jint JNICALL
+Java_com_osfans_trime_core_Rime_importRimeUserDb(JNIEnv* env,
+                                                 jclass /* thiz */,
+                                                 jstring db_name,
+                                                 jstring file,
+                                                 jboolean binary,
+                                                 jboolean replace) {
+  return importUserDb(*CString(env, db_name), *CString(env, file),
+                      binary ? UserDbFormat::kBinary : UserDbFormat::kText,
+                      replace);
+}
+
+extern "C" JNIEXPORT jint JNICALL
+Java_com_osfans_trime_core_Rime_exportRimeUserDb(JNIEnv* env,
+                                                 jclass /* thiz */,
+                                                 jstring db_name,
+                                                 jstring file,
+                                                 jboolean binary) {
+  return exportUserDb(*CString(env, db_name), *CString(env, file),
+                      binary ? UserDbFormat::kBinary : UserDbFormat::kText);
+}
+
+extern "C" JNIEXPORT void JNICALL
+Java_com_osfans_trime_core_Rime_cancelRimeUserDbTransfer(JNIEnv* env,
+                                                         jclass /* thiz */) {
+  cancelUserDbTransfer();
+}
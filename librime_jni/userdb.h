@@ -0,0 +1,61 @@
+/*
+ * SPDX-FileCopyrightText: 2015 - 2025 Rime community
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+//! Storage tuning for userdb, applied to databases opened afterwards.
+//! Zero keeps leveldb's own default for that setting.
+struct UserDbOptions {
+  size_t block_cache_size = 0;
+  size_t write_buffer_size = 0;
+  bool compression = true;
+  int bloom_bits_per_key = 0;
+};
+
+void setUserDbOptions(const UserDbOptions& options);
+
+//! Replaces librime's "userdb" component with the tunable one.
+//! Has to be called after every rime initialize().
+void installUserDbComponent();
+
+//! Compacts all open userdbs on a background thread.
+//! Returns the number of databases scheduled, 0 while an earlier
+//! compaction is still running.
+int compactUserDbs();
+
+//! Stops compacting after the current database and waits for the thread.
+void stopUserDbCompaction();
+
+//! Bytes held by the shared block cache and the memtables of open userdbs.
+int64_t userDbMemoryUsage();
+
+enum class UserDbFormat {
+  kText,    // "code<TAB>text<TAB>c=.. d=.. t=..", as in *.userdb.txt
+  kBinary,  // varint length-prefixed key/value records
+};
+
+//! Streams the entries of userdb `db_name` from or to `file` on a worker
+//! thread, one transfer at a time. Progress, completion and errors are
+//! posted as kUserDbMessage with args `[id, event, done, total]`, event
+//! being "progress", "done", "cancelled" or "error" (then `done` holds
+//! the reason). Returns the transfer id, or -1 if one is still running.
+//! An import merges entries the way librime's sync does, keeping the
+//! larger commit count and weight, unless `replace` is set. A db open in an
+//! engine is shared with it rather than locked against it.
+int importUserDb(const std::string& db_name,
+                 const std::string& file,
+                 UserDbFormat format,
+                 bool replace);
+int exportUserDb(const std::string& db_name,
+                 const std::string& file,
+                 UserDbFormat format);
+
+void cancelUserDbTransfer();
+
+//! Cancels the running transfer and waits for it to finish.
+void stopUserDbTransfer();
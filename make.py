@@ -1,7 +1,7 @@
 #!/usr/bin/env python3
 """
 Android NDK 跨平台构建工具
-支持 build, clean 和 format 命令
+支持 build, replay, pgo, profiles, clean 和 format 命令
 """
 
 import argparse
@@ -18,6 +18,9 @@ DEFAULT_CONFIG = {
     "min_api": 25,
     "build_type": "Release",
     "build_dir": "build-android",
+    "host_build_dir": "build-host",
+    "profile": "size",
+    "pgo_profile": "pgo/trime.profdata",
     "ndk_path": "",
     "jni_dir": "librime_jni",
 }
@@ -84,6 +87,8 @@ def build_project(args):
         config["build_type"] = "Debug"
     if args.min_api:
         config["min_api"] = args.min_api
+    if args.profile:
+        config["profile"] = args.profile
 
     # 验证 NDK 路径
     ndk_path = Path(config["ndk_path"])
@@ -128,6 +133,7 @@ def build_project(args):
             "-DCMAKE_EXPORT_COMPILE_COMMANDS=1",
         ]
     )
+    cmake_cmd.extend(profile_cmake_args(config["profile"], args.pgo_use))
 
     # 运行 CMake 配置
     print("\n" + "=" * 50)
@@ -135,6 +141,7 @@ def build_project(args):
     print(f"  架构: {config['arch']}")
     print(f"  最低 API 级别: {config['min_api']}")
     print(f"  构建类型: {config['build_type']}")
+    print(f"  构建配置: {config['profile']}{' + PGO' if args.pgo_use else ''}")
     print(f"  NDK: {config['ndk_path']}")
     print(f"  构建目录: {build_dir}")
     print("=" * 50 + "\n")
@@ -164,14 +171,179 @@ def build_project(args):
         sys.exit(1)
 
 
+def profile_cmake_args(profile, pgo_use=None, pgo_generate=False):
+    """构建配置与 PGO 对应的 CMake 选项"""
+    cmake_args = [f"-DTRIME_BUILD_PROFILE={profile}"]
+    if pgo_generate:
+        cmake_args.append("-DTRIME_PGO=generate")
+    elif pgo_use:
+        cmake_args.append("-DTRIME_PGO=use")
+        cmake_args.append(f"-DTRIME_PGO_PROFILE={Path(pgo_use).resolve()}")
+    else:
+        cmake_args.append("-DTRIME_PGO=off")
+    return cmake_args
+
+
+def host_build_dir(profile, pgo_use=None, pgo_generate=False):
+    """主机构建目录, 每种配置各用一个, 互不覆盖"""
+    build_dir = DEFAULT_CONFIG["host_build_dir"]
+    if profile != "size":
+        build_dir += f"-{profile}"
+    if pgo_generate:
+        build_dir += "-pgo-gen"
+    elif pgo_use:
+        build_dir += "-pgo"
+    return build_dir
+
+
+def build_host(build_dir, cmake_args, targets):
+    """在主机上用 clang 构建指定目标"""
+    cmake_cmd = [
+        "cmake",
+        ".",
+        "-B",
+        build_dir,
+        "-G",
+        "Ninja",
+        "-DCMAKE_BUILD_TYPE=Release",
+        "-DCMAKE_C_COMPILER=clang",
+        "-DCMAKE_CXX_COMPILER=clang++",
+        "-DBUILD_REPLAY=ON",
+    ] + cmake_args
+    res = subprocess.run(cmake_cmd)
+    if res.returncode != 0:
+        print("错误: CMake 配置失败")
+        sys.exit(1)
+
+    res = subprocess.run(["cmake", "--build", build_dir, "--target"] + targets)
+    if res.returncode != 0:
+        print("错误: 构建失败")
+        sys.exit(1)
+
+
+def replay_binary(build_dir):
+    return Path(build_dir) / DEFAULT_CONFIG["jni_dir"] / "rime_replay"
+
+
+def replay_project(args):
+    """构建并运行主机上的按键回放基准"""
+    build_dir = host_build_dir(args.profile, args.pgo_use)
+    build_host(
+        build_dir, profile_cmake_args(args.profile, args.pgo_use), ["rime_replay"]
+    )
+
+    # 其余参数原样传给 rime_replay
+    replay_args = [arg for arg in args.replay_args if arg != "--"]
+    if not replay_args:
+        return
+    binary = replay_binary(build_dir)
+    sys.exit(subprocess.run([str(binary)] + replay_args).returncode)
+
+
+def pgo_project(args):
+    """以按键回放为训练负载生成 PGO 配置文件"""
+    replay_args = [arg for arg in args.replay_args if arg != "--"]
+    if not replay_args:
+        print("错误: 需要传给 rime_replay 的参数, 作为训练负载")
+        sys.exit(1)
+    # .profraw 由主机 clang 产生, 用同一工具链的 llvm-profdata 合并
+    profdata = shutil.which("llvm-profdata")
+    if not profdata:
+        print("错误: 未找到 llvm-profdata")
+        sys.exit(1)
+
+    build_dir = host_build_dir(args.profile, pgo_generate=True)
+    build_host(
+        build_dir,
+        profile_cmake_args(args.profile, pgo_generate=True),
+        ["rime_replay"],
+    )
+
+    # 只合并本次训练产生的数据
+    raw_dir = Path(build_dir) / "pgo"
+    if raw_dir.exists():
+        shutil.rmtree(raw_dir)
+    res = subprocess.run([str(replay_binary(build_dir))] + replay_args)
+    if res.returncode != 0:
+        print("错误: 训练运行失败")
+        sys.exit(1)
+
+    output = Path(args.output)
+    output.parent.mkdir(parents=True, exist_ok=True)
+    raw_files = [str(f) for f in raw_dir.glob("*.profraw")]
+    if not raw_files:
+        print(f"错误: {raw_dir} 中没有 .profraw 文件")
+        sys.exit(1)
+    res = subprocess.run([profdata, "merge", "-o", str(output)] + raw_files)
+    if res.returncode != 0:
+        print("错误: 合并配置文件失败")
+        sys.exit(1)
+    print(f"PGO 配置文件: {output}")
+    print(f"使用: python make.py build --profile {args.profile} --pgo-use {output}")
+
+
+def profiles_project(args):
+    """构建各配置, 报告库体积与按键延迟相对 size 配置的变化"""
+    replay_args = [arg for arg in args.replay_args if arg != "--"]
+    if not replay_args:
+        print("错误: 需要传给 rime_replay 的参数")
+        sys.exit(1)
+
+    variants = [("size", "size", None), ("speed", "speed", None)]
+    if args.pgo_use:
+        variants.append(("speed+pgo", "speed", args.pgo_use))
+
+    metrics = ["total_p50_us", "total_p90_us", "total_p99_us"]
+    results = []
+    for name, profile, pgo_use in variants:
+        build_dir = host_build_dir(profile, pgo_use)
+        build_host(
+            build_dir,
+            profile_cmake_args(profile, pgo_use),
+            ["rime_jni", "rime_replay"],
+        )
+        library = Path(build_dir) / DEFAULT_CONFIG["jni_dir"] / "librime_jni.so"
+        report_file = Path(build_dir) / "replay-report.txt"
+        res = subprocess.run(
+            [str(replay_binary(build_dir)), "--save", str(report_file)] + replay_args,
+            stdout=subprocess.DEVNULL,
+        )
+        if res.returncode != 0:
+            print(f"错误: {name} 回放失败")
+            sys.exit(1)
+        report = {}
+        for line in report_file.read_text().splitlines():
+            key, value = line.split()
+            report[key] = float(value)
+        report["size"] = library.stat().st_size
+        results.append((name, report))
+
+    def delta(value, base):
+        return f"{(value - base) / base * 100:+.1f}%" if base else "-"
+
+    base = results[0][1]
+    print("\n" + "=" * 50)
+    print("配置对比 (主机构建, 相对 size)")
+    print("=" * 50)
+    header = ["配置", "librime_jni.so"] + metrics
+    print("  ".join(f"{h:>18}" for h in header))
+    for name, report in results:
+        cells = [name, f"{report['size'] / 1024:.0f}K {delta(report['size'], base['size'])}"]
+        for metric in metrics:
+            cells.append(f"{report[metric]:.0f} {delta(report[metric], base[metric])}")
+        print("  ".join(f"{c:>18}" for c in cells))
+
+
 def clean_project(args):
     """清理构建目录"""
     config = DEFAULT_CONFIG.copy()
 
-    clean_dir = Path(config["build_dir"])
-    # 执行清理
-    if clean_dir.exists():
-        shutil.rmtree(clean_dir)
+    # 执行清理, 包括各配置的主机构建目录
+    clean_dirs = [Path(config["build_dir"])]
+    clean_dirs.extend(Path(".").glob(config["host_build_dir"] + "*"))
+    for clean_dir in clean_dirs:
+        if clean_dir.exists():
+            shutil.rmtree(clean_dir)
 
 
 def format_code(args):
@@ -234,8 +406,48 @@ def main():
     build_parser.add_argument("--release", action="store_true", help="发布构建")
     build_parser.add_argument("--debug", action="store_true", help="调试构建")
     build_parser.add_argument("--min-api", type=int, help="最低 Android API 级别")
+    build_parser.add_argument(
+        "--profile", choices=["size", "speed"], help="构建配置 (默认 size)"
+    )
+    build_parser.add_argument("--pgo-use", help="PGO 配置文件 (.profdata)")
     build_parser.set_defaults(func=build_project)
 
+    # replay 命令
+    replay_parser = subparsers.add_parser("replay", help="构建并运行按键回放基准")
+    replay_parser.add_argument(
+        "--profile", choices=["size", "speed"], default="size", help="构建配置"
+    )
+    replay_parser.add_argument("--pgo-use", help="PGO 配置文件 (.profdata)")
+    replay_parser.add_argument(
+        "replay_args", nargs=argparse.REMAINDER, help="传给 rime_replay 的参数"
+    )
+    replay_parser.set_defaults(func=replay_project)
+
+    # pgo 命令
+    pgo_parser = subparsers.add_parser("pgo", help="以按键回放训练 PGO 配置文件")
+    pgo_parser.add_argument(
+        "--profile", choices=["size", "speed"], default="speed", help="构建配置"
+    )
+    pgo_parser.add_argument(
+        "--output", default=DEFAULT_CONFIG["pgo_profile"], help="输出的 .profdata"
+    )
+    pgo_parser.add_argument(
+        "replay_args", nargs=argparse.REMAINDER, help="传给 rime_replay 的参数"
+    )
+    pgo_parser.set_defaults(func=pgo_project)
+
+    # profiles 命令
+    profiles_parser = subparsers.add_parser(
+        "profiles", help="对比各构建配置的体积与延迟"
+    )
+    profiles_parser.add_argument(
+        "--pgo-use", help="同时对比使用此 PGO 配置文件的 speed 构建"
+    )
+    profiles_parser.add_argument(
+        "replay_args", nargs=argparse.REMAINDER, help="传给 rime_replay 的参数"
+    )
+    profiles_parser.set_defaults(func=profiles_project)
+
     # clean 命令
     clean_parser = subparsers.add_parser("clean", help="清理构建目录")
     clean_parser.set_defaults(func=clean_project)